@@ -2082,6 +2082,8 @@ svm_model svm_train(const svm_problem *prob, const svm_parameter *param)
 	svm_model model;
 	model.param = *param;
 	model.free_sv = 0;	// XXX
+	model.w = NULL;
+	model.w_len = 0;
 
 	if(param->svm_type == ONE_CLASS ||
 	   param->svm_type == EPSILON_SVR ||
@@ -2459,16 +2461,79 @@ double svm_get_svr_probability(const svm_model *model)
 	}
 }
 
+// w = sum_i sv_coef[i] SV[i] for SvmRegressor::train; kept only if shorter than the SVs' nodes
+void svm_collapse_linear(svm_model *model)
+{
+	free(model->w);
+	model->w = NULL;
+	model->w_len = 0;
+	if(model->param.kernel_type != LINEAR ||
+	   (model->param.svm_type != ONE_CLASS &&
+	    model->param.svm_type != EPSILON_SVR &&
+	    model->param.svm_type != NU_SVR))
+		return;
+
+	int w_len = 1;
+	long nodes = 0;
+	for(int i=0;i<model->l;i++)
+	{
+		int last = 0;
+		for(const svm_node *p=model->SV[i];p->index!=-1;p++)
+		{
+			if(p->index <= last)
+				return;
+			last = p->index;
+			nodes++;
+		}
+		w_len = max(w_len,last+1);
+	}
+	if(w_len >= nodes)
+		return;
+
+	double *w = Malloc(double,w_len);
+	for(int k=0;k<w_len;k++)
+		w[k] = 0;
+	const double *sv_coef = model->sv_coef[0];
+	for(int i=0;i<model->l;i++)
+		for(const svm_node *p=model->SV[i];p->index!=-1;p++)
+			w[p->index] += sv_coef[i] * p->value;
+	model->w = w;
+	model->w_len = w_len;
+}
+
+// <w, x>; 0 (and the SV-by-SV sum is used) if x's indices do not ascend
+static int linear_decision(const svm_model *model, const svm_node *x, double *sum)
+{
+	const double *w = model->w;
+	const int w_len = model->w_len;
+	double s = 0;
+	int last = 0;
+	for(;x->index!=-1;x++)
+	{
+		if(x->index <= last)
+			return 0;
+		last = x->index;
+		if(last < w_len)
+			s += w[last] * x->value;
+	}
+	*sum = s;
+	return 1;
+}
+
 double svm_predict_values(const svm_model *model, const svm_node *x, double* dec_values)
 {
 	if(model->param.svm_type == ONE_CLASS ||
 	   model->param.svm_type == EPSILON_SVR ||
 	   model->param.svm_type == NU_SVR)
 	{
-		double *sv_coef = model->sv_coef[0];
-		double sum = 0;
-		for(int i=0;i<model->l;i++)
-			sum += sv_coef[i] * Kernel::k_function(x,model->SV[i],model->param);
+		double sum;
+		if(!model->w || !linear_decision(model,x,&sum))
+		{
+			double *sv_coef = model->sv_coef[0];
+			sum = 0;
+			for(int i=0;i<model->l;i++)
+				sum += sv_coef[i] * Kernel::k_function(x,model->SV[i],model->param);
+		}
 		sum -= model->rho[0];
 		*dec_values = sum;
 
@@ -2721,6 +2786,8 @@ svm_model *svm_load_model(const char *model_file_name)
 	model->probB = NULL;
 	model->label = NULL;
 	model->nSV = NULL;
+	model->w = NULL;
+	model->w_len = 0;
 
 	char cmd[81];
 	while(1)
@@ -2904,6 +2971,7 @@ svm_model *svm_load_model(const char *model_file_name)
 		return NULL;
 
 	model->free_sv = 1;	// XXX
+	svm_collapse_linear(model);
 	return model;
 }
 
@@ -2920,6 +2988,9 @@ void svm_free_model_content(svm_model* model_ptr)
 	free(model_ptr->SV);
 	model_ptr->SV = NULL;
 
+	free(model_ptr->w);
+	model_ptr->w = NULL;
+
 	free(model_ptr->sv_coef);
 	model_ptr->sv_coef = NULL;
 
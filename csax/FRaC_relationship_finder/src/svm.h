@@ -77,6 +77,9 @@ struct svm_model
 	/* XXX */
 	int free_sv;		/* 1 if svm_model is created by svm_load_model*/
 				/* 0 if svm_model is created by svm_train */
+
+	double *w;		/* LINEAR one-function models: sum of sv_coef*SV by index (w[w_len]), */
+	int w_len;		/* which svm_predict uses; NULL if none (see svm_collapse_linear) */
 };
 
 struct svm_model* svm_train_alloc(const svm_problem *prob, const svm_parameter *param);
@@ -95,6 +98,7 @@ double svm_predict_values(const struct svm_model *model, const struct svm_node *
 double svm_predict(const struct svm_model *model, const struct svm_node *x);
 double svm_predict_probability(const struct svm_model *model, const struct svm_node *x, double* prob_estimates);
 
+void svm_collapse_linear(struct svm_model *model); /* set w of a model that predicts many instances */
 void svm_free_model_content(struct svm_model *model_ptr);
 void svm_free_and_destroy_model(struct svm_model **model_ptr_ptr);
 void svm_destroy_param(struct svm_parameter *param);
@@ -189,6 +189,8 @@ void SvmRegressor::train(Array<Sample> training){
   
   //dump_svm_problem(stdout, &prob, "");
   model = svm_train(&prob, params);
+  //A linear model predicts with one weight per column, no more than its SVs hold.
+  svm_collapse_linear(&model);
 }
 
 fracfloat_t SvmRegressor::predict(Sample sample){
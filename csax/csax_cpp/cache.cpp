@@ -0,0 +1,104 @@
+// FRaC result cache Implementation
+
+#include "cache.h"
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+static const char MAGIC[8] = {'C', 'S', 'A', 'X', 'N', 'S', '1', '\0'};
+
+uint64_t fnv1a(const void *data, size_t length, uint64_t hash)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*hashes the length too, so consecutive strings cannot run together */
+uint64_t fnv1a(const string &s, uint64_t hash)
+{
+    uint64_t length = s.size();
+    hash = fnv1a(&length, sizeof(length), hash);
+    return fnv1a(s.data(), s.size(), hash);
+}
+
+/*hashes the contents of a file (nothing if it cannot be read) */
+uint64_t fnv1aFile(string filename, uint64_t hash)
+{
+    ifstream f(filename, ios::binary);
+    char buffer[65536];
+    while (f.read(buffer, sizeof(buffer)) || f.gcount() > 0) {
+        hash = fnv1a(buffer, f.gcount(), hash);
+    }
+    return hash;
+}
+
+string makeDirectory(string dir)
+{
+    if (dir.empty() || dir[dir.length() - 1] != '/') {
+        dir += '/';
+    }
+    mkdir(dir.c_str(), 0777);
+    struct stat st;
+    if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        cerr << "Could not create directory " << dir << endl;
+        exit(1);
+    }
+    return dir;
+}
+
+/*Creates dir if it does not exist yet */
+ResultCache::ResultCache(string dir)
+{
+    this->dir = makeDirectory(dir);
+}
+
+string ResultCache::path(uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.ns", (unsigned long long)key);
+    return dir + name;
+}
+
+/*Reads the entry of key into values; false if there is none (or it is not
+ *a complete entry)
+ */
+bool ResultCache::load(uint64_t key, vector<double> &values)
+{
+    ifstream f(path(key), ios::binary);
+    char magic[8];
+    uint64_t length;
+    if (!f.read(magic, 8) || memcmp(magic, MAGIC, 8) != 0 ||
+            !f.read((char *)&length, sizeof(length))) {
+        return false;
+    }
+    values.resize(length);
+    return (bool)f.read((char *)values.data(), length * sizeof(double));
+}
+
+void ResultCache::store(uint64_t key, const vector<double> &values)
+{
+    string final_path = path(key);
+    hash<thread::id> thread_hash;
+    string temp_path = final_path + ".tmp." + to_string(getpid()) + "." +
+        to_string(thread_hash(this_thread::get_id()));
+    ofstream f(temp_path, ios::binary | ios::trunc);
+    uint64_t length = values.size();
+    f.write(MAGIC, 8);
+    f.write((const char *)&length, sizeof(length));
+    f.write((const char *)values.data(), length * sizeof(double));
+    f.close();
+    if (!f.good() || rename(temp_path.c_str(), final_path.c_str()) != 0) {
+        cerr << "Warning: could not write cache entry " << final_path << endl;
+        remove(temp_path.c_str());
+    }
+}
@@ -0,0 +1,36 @@
+// FRaC result cache Interface
+// Normalized surprisal of one test sample under one bag, stored under a hash
+// of everything it depends on
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+/*64-bit FNV-1a; pass the previous hash to continue it over more data */
+const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+uint64_t fnv1a(const void *data, size_t length, uint64_t hash = FNV_OFFSET);
+uint64_t fnv1a(const string &s, uint64_t hash = FNV_OFFSET);
+uint64_t fnv1aFile(string filename, uint64_t hash = FNV_OFFSET);
+
+/*Creates dir if needed; returns it with a trailing / */
+string makeDirectory(string dir);
+
+/*A directory of <key>.ns files, one vector of doubles each.
+ *Entries are written to a temporary file and renamed, so concurrent bags
+ *(or runs) sharing the directory never see a partial entry.
+ */
+class ResultCache {
+    public:
+        ResultCache(string dir);
+        bool load(uint64_t key, vector<double> &values);
+        void store(uint64_t key, const vector<double> &values);
+    private:
+        string path(uint64_t key);
+        string dir;
+};
+
+#endif
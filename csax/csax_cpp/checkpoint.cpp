@@ -0,0 +1,196 @@
+// CSAX checkpoint Implementation
+// See checkpoint.h for the layout
+
+#include "checkpoint.h"
+#include "cache.h"
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+using namespace std;
+
+static const char MAGIC[8] = {'C', 'S', 'A', 'X', 'C', 'K', 'P', '1'};
+
+/*Opens filename for a run. With CREATE any old checkpoint is replaced;
+ *with RESUME or READ its records are read back (and kept), and it has to
+ *belong to a run with the same fingerprint. READ opens nothing for writing
+ */
+Checkpoint::Checkpoint(string filename, uint64_t fingerprint,
+        unsigned numTests, unsigned numSets, Mode mode)
+{
+    this->numTests = numTests;
+    this->numSets = numSets;
+    haveFullSet = false;
+    file = NULL;
+
+    bool resume = mode == RESUME;
+    if (mode == READ) {
+        replay(filename, fingerprint, false);
+        return;
+    }
+    if (resume && replay(filename, fingerprint, true)) {
+        file = fopen(filename.c_str(), "ab");
+    } else {
+        if (resume) {
+            cout << "No checkpoint to resume from in " << filename
+                 << ", starting over" << endl;
+        }
+        file = fopen(filename.c_str(), "wb");
+        if (file) {
+            uint32_t sizes[2] = {numTests, numSets};
+            fwrite(MAGIC, 1, 8, file);
+            fwrite(&fingerprint, sizeof(fingerprint), 1, file);
+            fwrite(sizes, sizeof(uint32_t), 2, file);
+            fflush(file);
+        }
+    }
+    if (!file) {
+        cerr << "Could not write checkpoint " << filename << endl;
+        exit(1);
+    }
+}
+
+Checkpoint::~Checkpoint()
+{
+    if (file) {
+        fclose(file);
+    }
+}
+
+/*Reads the records of an existing checkpoint and, with truncateTorn, cuts
+ *off a torn last record. False if there is no checkpoint; exits if it is
+ *another run's
+ */
+bool Checkpoint::replay(const string &filename, uint64_t fingerprint,
+        bool truncateTorn)
+{
+    FILE *in = fopen(filename.c_str(), "rb");
+    if (!in) {
+        return false;
+    }
+    char magic[8];
+    uint64_t stored;
+    uint32_t sizes[2];
+    if (fread(magic, 1, 8, in) != 8 || memcmp(magic, MAGIC, 8) != 0 ||
+            fread(&stored, sizeof(stored), 1, in) != 1 ||
+            fread(sizes, sizeof(uint32_t), 2, in) != 2) {
+        fclose(in);
+        return false;
+    }
+    if (stored != fingerprint || sizes[0] != numTests || sizes[1] != numSets) {
+        cerr << filename << " is the checkpoint of a run with other inputs"
+             << " or settings; remove it or leave out --resume" << endl;
+        exit(1);
+    }
+
+    long good = ftell(in);
+    uint32_t head[2];
+    string payload;
+    uint64_t checksum;
+    while (fread(head, sizeof(uint32_t), 2, in) == 2) {
+        payload.resize(head[1]);
+        if (fread(&payload[0], 1, head[1], in) != head[1] ||
+                fread(&checksum, sizeof(checksum), 1, in) != 1 ||
+                checksum != fnv1a(payload.data(), payload.size())) {
+            break;
+        }
+        const char *p = payload.data();
+        const char *end = p + payload.size();
+        if (head[0] == FULL_SET) {
+            if (payload.size() != (size_t)numTests * numSets * sizeof(double)) {
+                break;
+            }
+            full.assign(numTests, vector<double>(numSets));
+            for (unsigned i = 0; i < numTests; i++) {
+                memcpy(full[i].data(), p, numSets * sizeof(double));
+                p += numSets * sizeof(double);
+            }
+            haveFullSet = true;
+        } else {
+            vector<vector<unsigned> > rankings(numTests);
+            bool valid = true;
+            for (unsigned i = 0; i < numTests && valid; i++) {
+                uint32_t n;
+                valid = end - p >= (long)sizeof(n);
+                if (valid) {
+                    memcpy(&n, p, sizeof(n));
+                    p += sizeof(n);
+                    valid = (size_t)(end - p) >= (size_t)n * sizeof(uint32_t);
+                }
+                if (valid) {
+                    rankings[i].resize(n);
+                    memcpy(rankings[i].data(), p, n * sizeof(uint32_t));
+                    p += n * sizeof(uint32_t);
+                }
+            }
+            if (!valid) {
+                break;
+            }
+            bags[head[0]].swap(rankings);
+        }
+        good = ftell(in);
+    }
+    fclose(in);
+
+    if (truncateTorn && truncate(filename.c_str(), good) != 0) {
+        cerr << "Could not truncate checkpoint " << filename << endl;
+        exit(1);
+    }
+    return true;
+}
+
+/*Appends one record and flushes it to disk */
+void Checkpoint::append(uint32_t bag, const string &payload)
+{
+    uint32_t head[2] = {bag, (uint32_t)payload.size()};
+    uint64_t checksum = fnv1a(payload.data(), payload.size());
+    fwrite(head, sizeof(uint32_t), 2, file);
+    fwrite(payload.data(), 1, payload.size(), file);
+    fwrite(&checksum, sizeof(checksum), 1, file);
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+        cerr << "Warning: could not write checkpoint record" << endl;
+    }
+}
+
+/*The replayed enrichment scores of the full training set, if any */
+bool Checkpoint::fullSet(vector<vector<double> > &ES)
+{
+    if (haveFullSet) {
+        ES = full;
+    }
+    return haveFullSet;
+}
+
+void Checkpoint::writeFullSet(const vector<vector<double> > &ES)
+{
+    string payload;
+    for (unsigned i = 0; i < ES.size(); i++) {
+        payload.append((const char *)ES[i].data(),
+                ES[i].size() * sizeof(double));
+    }
+    append(FULL_SET, payload);
+}
+
+/*The replayed rankings of bag b, if it was done */
+bool Checkpoint::bag(unsigned b, vector<vector<unsigned> > &rankings)
+{
+    auto it = bags.find(b);
+    if (it == bags.end()) {
+        return false;
+    }
+    rankings.swap(it->second);
+    bags.erase(it);
+    return true;
+}
+
+void Checkpoint::writeBag(unsigned b,
+        const vector<vector<unsigned> > &rankings)
+{
+    string payload;
+    for (unsigned i = 0; i < rankings.size(); i++) {
+        uint32_t n = rankings[i].size();
+        payload.append((const char *)&n, sizeof(n));
+        payload.append((const char *)rankings[i].data(), n * sizeof(uint32_t));
+    }
+    append(b, payload);
+}
@@ -0,0 +1,55 @@
+// CSAX checkpoint Interface
+// Append-only record of a run's finished work, so a killed run can resume
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+/*File layout (native byte order):
+ *    char     magic[8]      "CSAXCKP1"
+ *    uint64_t fingerprint   hash of the inputs and settings of the run
+ *    uint32_t numTests, numSets
+ *then records, appended as work finishes:
+ *    uint32_t bag           FULL_SET for the full training set
+ *    uint32_t length        bytes of payload
+ *    payload                full set: numTests x numSets double ES
+ *                           (NaN for sets without positive enrichment)
+ *                           bag: per test sample, uint32_t n and the n
+ *                           gene set ids in rank order
+ *    uint64_t checksum      fnv1a of the payload
+ *A record cut short by a kill fails its checksum and is dropped on resume.
+ *Modes: CREATE replaces any old checkpoint; RESUME replays one and appends
+ *to it (truncating a torn record); READ only replays it, never writing
+ *(e.g. another worker's published result, possibly on a read-only share).
+ */
+class Checkpoint {
+    public:
+        static const uint32_t FULL_SET = 0xffffffff;
+        enum Mode { CREATE, RESUME, READ };
+
+        Checkpoint(string filename, uint64_t fingerprint, unsigned numTests,
+                unsigned numSets, Mode mode);
+        ~Checkpoint();
+        bool fullSet(vector<vector<double> > &ES);
+        void writeFullSet(const vector<vector<double> > &ES);
+        bool bag(unsigned b, vector<vector<unsigned> > &rankings);
+        void writeBag(unsigned b, const vector<vector<unsigned> > &rankings);
+    private:
+        bool replay(const string &filename, uint64_t fingerprint,
+                bool truncateTorn);
+        void append(uint32_t bag, const string &payload);
+        FILE *file;
+        unsigned numTests;
+        unsigned numSets;
+        bool haveFullSet;
+        vector<vector<double> > full;
+        map<unsigned, vector<vector<unsigned> > > bags;
+};
+
+#endif
@@ -6,9 +6,15 @@
 //#include <boost/algorithm/string/split.hpp>
 #include <algorithm>
 #include "genesetmanager.h"
+#include "gsea.h"
 #include "sample.h"
+#include "cache.h"
+#include "checkpoint.h"
+#include "workqueue.h"
+#include "profile.h"
+#include "frac/src/fraclib.h"
 #include <vector>
-#include <map>
+#include <cmath>
 #include <fstream>
 #include <sstream>
 #include <stdio.h>
@@ -16,80 +22,462 @@
 #include <iostream>
 #include <string>
 #include <cstring>
-#include <sys/types.h>
-#include <dirent.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <random>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 using namespace std;
 
-struct GeneScoreList {
-    string gene;
-    vector<double> scores;
+/* Gene set ids of one bag in rank order, for each test sample */
+typedef vector<vector<unsigned> > BagRankings;
+
+/* Normalized surprisal of every gene, for each test sample */
+typedef vector<vector<double> > SurprisalScores;
+
+/* Enrichment scores of each test sample, by gene set id (see GSEA) */
+typedef vector<vector<double> > EnrichmentScores;
+
+/* Indices (into the training samples) of the samples in one bag */
+typedef vector<int> Bag;
+
+/* FRaC problems of all training and all test samples, built once and only
+ * read afterwards; bags are views of train
+ * The keys hash each sample and the settings for the (optional) cache
+ */
+struct FRaCData {
+    svm_problem *train;
+    svm_problem *test;
+    const vector<string> *geneNames;
+    svm_parameter param;
+    ResultCache *cache;
+    string model_dir;
+    bool score_only;
+    vector<uint64_t> trainKeys;
+    vector<uint64_t> testKeys;
+    uint64_t settingsKey;
 };
 
 string OUTPUT_DIR = "";
+mutex LOG_MUTEX; // bags log from several threads
+volatile sig_atomic_t SERVE_STOP = 0; // set by SIGTERM/SIGINT in --serve -U
+int SERVE_SOCKET = -1;
 
 // Declarations
 void initializeOutputDir(string output_dir);
-vector<GeneScoreList *> runFRaC(SampleList traindata, string testfile,
-        bool use_all);
-vector<map<string, double>*> runGSEA(string genesets_file,
-        vector<GeneScoreList *> genescores);
-void CSAX_iteration(SampleList traindata, SampleList testdata, string testfile,
-        string genesets_file, vector<GeneSetManager *> managers);
-void samplesToFile(SampleList samples, string filename, double percent_to_add);
-vector<GeneScoreList *> parseFRaCOutput(string fracFileP);
-map<string, double> *parseGSEAOutput(string gseaFileP);
-void writeGSEAInput(vector<GeneScoreList *> genescores, unsigned index,
-        string filename);
+void logLine(string line);
+SurprisalScores runFRaC(const FRaCData &data, const Bag &bag,
+        const vector<int> &tests);
+SurprisalScores bagSurprisal(const FRaCData &data, const Bag &bag);
+uint64_t bagKey(const FRaCData &data, const Bag &bag);
+string bagModelFile(const FRaCData &data, const Bag &bag);
+bool loadBagModels(const FRaCData &data, const Bag &bag,
+        const svm_problem *prob_X, vector<frac_model> &models);
+void saveBagModels(const FRaCData &data, const Bag &bag,
+        const svm_problem *prob_X, const vector<frac_model> &models);
+vector<uint64_t> sampleKeys(const SampleMatrix &samples);
+uint64_t settingsKey(const svm_parameter &param,
+        const vector<string> &geneNames);
+EnrichmentScores runGSEA(GSEA &gsea, const SurprisalScores &ns);
+void runBags(const FRaCData &data, GSEA &gsea, const vector<Bag> &bags,
+        GeneSetManager &manager, Checkpoint &checkpoint, unsigned jobs,
+        unsigned interim,
+        function<vector<double>(GeneSetManager &)> interim_scores,
+        function<void(unsigned, const vector<double> &)> write_interim);
+BagRankings CSAX_iteration(const FRaCData &data, GSEA &gsea,
+        const Bag &bag);
+vector<unsigned> rankGeneSets(const vector<double> &ES, const GSEA &gsea);
+void runWorker(const FRaCData &data, GSEA &gsea, const Bag &full,
+        const vector<Bag> &bags, WorkQueue &queue, const CSAXOptions &options,
+        const SampleMatrix &testdata);
+void reduceQueue(WorkQueue &queue, unsigned num_bags, GeneSetManager &manager,
+        EnrichmentScores &ES);
+void addRankings(GeneSetManager &manager, const BagRankings &rankings);
+void writeScores(GeneSetManager &manager, const EnrichmentScores &ES,
+        const SampleMatrix &testdata, double gamma, unsigned jobs,
+        string output_file);
+void writeScoreFile(const vector<double> &scores,
+        const SampleMatrix &testdata, string output_file);
+void writeGSEAReports(GSEA &gsea, const SurprisalScores &ns,
+        const SampleMatrix &testdata);
+Bag selectBag(unsigned numTraining, double percent_to_add, unsigned seed);
+svm_problem *samplesToProblem(const SampleMatrix &samples);
 
 /* Function runCSAX:
  * Takes in parsed data from the training data and testdata
  * respectively
- * Takes in The filepointer for the testfile, and the parsed data (currently
- * redundant)
- * Also the output directory, and the number of bagging iterations
- * Also takes in gamma (0.95 typically used)
+ * Also the output directory, and the options: the number of bagging
+ * iterations, gamma (0.95 typically used), the number of GSEA
+ * permutations for the reports and the number of bags to run at once
  *
  * Runs CSAX on the full training data, and then performs one iteration on a
  * random half of the data, num_bags number of iterations
  */
-void runCSAX(SampleList traindata, SampleList testdata, string testfile,
-        string genesets_file, string output_dir, int num_bags, double gamma)
+void runCSAX(const SampleMatrix &traindata, const SampleMatrix &testdata,
+        string genesets_file, string output_dir, const CSAXOptions &options)
 {
-    cout << "Running CSAX on whole training set" << endl;
+    int num_bags = options.num_bags;
+    double gamma = options.gamma;
     initializeOutputDir(output_dir);
-    // First, we have to process the full training data
-    vector<GeneScoreList *> genescores =
-        runFRaC(traindata, testfile, true);
+    // The samples are copied into FRaC problems once; every bag reads them
+    FRaCData data;
+    {
+        ProfileScope scope("bag_materialize");
+        data.train = samplesToProblem(traindata);
+        data.test = samplesToProblem(testdata);
+    }
+    data.geneNames = &traindata.getGeneNames();
+    // Same flags frac.r passed to frac/frac: -t 0 -c 1 -p 0, leave-one-out
+    frac_default_parameter(&data.param);
+    // Kernels of every bag read one dense copy of the training values
+    data.param.dense = svm_dense_alloc(data.train);
+    // -j threads in all: bag threads hold one each while they run bags, and
+    // the rest compute the kernel columns of the bags still running
+    svm_set_num_threads(options.jobs);
+    data.trainKeys = sampleKeys(traindata);
+    data.testKeys = sampleKeys(testdata);
+    data.settingsKey = settingsKey(data.param, traindata.getGeneNames());
+    ResultCache *cache = NULL;
+    if (options.cache_dir != "") {
+        cache = new ResultCache(options.cache_dir);
+    }
+    data.cache = cache;
+    data.model_dir = "";
+    if (options.model_dir != "") {
+        data.model_dir = makeDirectory(options.model_dir);
+    }
+    data.score_only = options.score_only;
+    if (data.score_only && data.model_dir == "") {
+        cerr << "--score needs a model directory (-M)" << endl;
+        exit(1);
+    }
 
-    // Run GSEA as well
-    vector<map<string, double>*> ES = runGSEA(genesets_file, genescores);
+    // Read the gene set database once; every GSEA call scores in memory
+    GSEA gsea(genesets_file, traindata.getGeneNames());
+    gsea.setPermutations(options.nperm, 9141976, options.jobs);
 
-    vector<GeneSetManager*> managers;
-    for (unsigned i = 0; i < testdata.data.size(); i++) {
-        managers.push_back(new GeneSetManager());
+    // Finished work is appended to the checkpoint, which a run with the same
+    // inputs, settings and seed can resume from
+    uint64_t fingerprint = data.settingsKey;
+    for (unsigned i = 0; i < data.trainKeys.size(); i++) {
+        fingerprint = fnv1a(&data.trainKeys[i], sizeof(uint64_t), fingerprint);
     }
+    for (unsigned i = 0; i < data.testKeys.size(); i++) {
+        fingerprint = fnv1a(&data.testKeys[i], sizeof(uint64_t), fingerprint);
+    }
+    fingerprint = fnv1a(&options.seed, sizeof(options.seed), fingerprint);
+    fingerprint = fnv1aFile(genesets_file, fingerprint);
 
-    //int num_bags = 5;
+    // Bag b is drawn from seed + b, so it is the same in any run with the
+    // same seed, however many bags it has or runs at once
+    vector<Bag> bags;
     for (int b = 0; b < num_bags; b++) {
-        cout << "Running csax on iteration: " << b << endl;
-        CSAX_iteration(traindata, testdata, testfile, genesets_file, managers);
+        bags.push_back(selectBag(traindata.numSamples(), .5,
+                    options.seed + b));
     }
-
     string output_file = OUTPUT_DIR + "csax_anomaly_scores";
-    ofstream f;
-    f.open(output_file);
 
-    double cur_score = 0;
-    for (unsigned i = 0;i  < testdata.data.size(); i++) {
-        cur_score = managers[i]->getAnomalyScore(gamma, ES[i]);
-        f << testdata.data[i]->getName() << "\t" << cur_score << endl;
+    // Workers of the same run, on this or other machines, share the full
+    // training set and the bags through the queue directory; the reduce
+    // step scores what they finished
+    if (options.worker || options.reduce) {
+        WorkQueue queue(OUTPUT_DIR + "queue", fingerprint,
+                testdata.numSamples(), gsea.numGeneSets());
+        if (options.worker) {
+            runWorker(data, gsea, selectBag(traindata.numSamples(), 1, 0),
+                    bags, queue, options, testdata);
+            cout << "No work left in " << OUTPUT_DIR << "queue" << endl;
+        } else {
+            GeneSetManager manager(testdata.numSamples(), gsea.numGeneSets());
+            EnrichmentScores ES;
+            reduceQueue(queue, bags.size(), manager, ES);
+            writeScores(manager, ES, testdata, gamma, options.jobs,
+                    output_file);
+            cout << "CSAX Finished! output in " << output_file << endl;
+        }
+        svm_dense_free(data.param.dense);
+        frac_free_problem(data.train);
+        frac_free_problem(data.test);
+        delete cache;
+        return;
     }
 
-    f.close();
+    Checkpoint checkpoint(OUTPUT_DIR + "csax_checkpoint", fingerprint,
+            testdata.numSamples(), gsea.numGeneSets(),
+            options.resume ? Checkpoint::RESUME : Checkpoint::CREATE);
+
+    // First, we have to process the full training data, and run GSEA as
+    // well. Ranking only needs enrichment scores, permutations are only run
+    // for the reports
+    EnrichmentScores ES;
+    bool replayed = checkpoint.fullSet(ES);
+    if (!replayed || options.nperm > 0) {
+        cout << "Running CSAX on whole training set" << endl;
+        SurprisalScores ns =
+            bagSurprisal(data, selectBag(traindata.numSamples(), 1, 0));
+        if (!replayed) {
+            ES = runGSEA(gsea, ns);
+            checkpoint.writeFullSet(ES);
+        }
+        if (options.nperm > 0) {
+            writeGSEAReports(gsea, ns, testdata);
+        }
+    }
+
+    GeneSetManager manager(testdata.numSamples(), gsea.numGeneSets());
+
+    // Medians can be read at any time, so scores of the bags so far can be
+    // written while the rest run
+    auto interimScores = [&](GeneSetManager &merged) {
+        return merged.getAnomalyScores(gamma, ES, options.jobs);
+    };
+    auto writeInterim = [&](unsigned done, const vector<double> &scores) {
+        writeScoreFile(scores, testdata,
+                OUTPUT_DIR + "csax_anomaly_scores." + to_string(done));
+    };
+    runBags(data, gsea, bags, manager, checkpoint, options.jobs,
+            options.interim, interimScores, writeInterim);
+    svm_dense_free(data.param.dense);
+    frac_free_problem(data.train);
+    frac_free_problem(data.test);
+    delete cache;
+
+    {
+        ProfileScope scope("aggregation");
+        writeScores(manager, ES, testdata, gamma, options.jobs,
+                output_file);
+    }
     cout << "CSAX Finished! output in " << output_file << endl;
 
 }
 
+/* Bag models of a served training set, resident between requests */
+struct ServedModels {
+    vector<vector<frac_model> > full; // one entry: the full training set
+    vector<vector<frac_model> > bags;
+};
+
+/* Normalized surprisal of one sample (numGenes values) under a bag's models
+ */
+vector<double> scoreSample(const vector<frac_model> &models,
+        const vector<double> &values)
+{
+    unsigned numGenes = values.size();
+    svm_problem *prob_Q = frac_alloc_problem(1, numGenes);
+    for (unsigned j = 0; j < numGenes; j++) {
+        prob_Q->x[0][j].value = values[j];
+    }
+    vector<double> ns(numGenes);
+    for (unsigned j = 0; j < numGenes; j++) {
+        frac_score(&models[j], prob_Q, &ns[j]);
+    }
+    frac_free_problem(prob_Q);
+    return ns;
+}
+
+/* Answers one request line: "<name>\t<value of each gene, in training set
+ * order, tab separated>". The reply is "<name>\t<anomaly score>" followed by
+ * "\t<gene set>:<contribution>" for the top contributing gene sets, or
+ * "ERROR\t<reason>"
+ */
+string serveRequest(const string &line, unsigned numGenes, GSEA &gsea,
+        const ServedModels &models, const CSAXOptions &options)
+{
+    istringstream fields(line);
+    string name, field;
+    getline(fields, name, '\t');
+    vector<double> values;
+    while (getline(fields, field, '\t')) {
+        char *end;
+        double value = strtod(field.c_str(), &end);
+        if (end == field.c_str() || *end != '\0' || !std::isfinite(value)) {
+            return "ERROR\tnot a number: " + field;
+        }
+        values.push_back(value);
+    }
+    if (name.empty() || values.size() != numGenes) {
+        return "ERROR\texpected a name and " + to_string(numGenes) +
+            " values, got " + to_string(values.size());
+    }
+
+    vector<double> ES = gsea.enrichmentScores(scoreSample(models.full[0],
+                values));
+    GeneSetManager manager(1, gsea.numGeneSets());
+    for (unsigned b = 0; b < models.bags.size(); b++) {
+        vector<double> bagES = gsea.enrichmentScores(
+                scoreSample(models.bags[b], values));
+        manager.addRankings(0, rankGeneSets(bagES, gsea));
+    }
+
+    ostringstream reply;
+    reply << name << "\t" << manager.getAnomalyScore(0, options.gamma, ES);
+    vector<pair<unsigned, double> > terms =
+        manager.getContributions(0, options.gamma, ES);
+    stable_sort(terms.begin(), terms.end(), [](const pair<unsigned, double> &a,
+                const pair<unsigned, double> &b) { return a.second > b.second; });
+    for (unsigned k = 0; k < terms.size() && k < options.top_sets; k++) {
+        if (terms[k].second <= 0) {
+            break;
+        }
+        reply << "\t" << gsea.getName(terms[k].first) << ":" << terms[k].second;
+    }
+    return reply.str();
+}
+
+/* Answers request lines from in on out until end of input */
+void serveStream(FILE *in, FILE *out, unsigned numGenes, GSEA &gsea,
+        const ServedModels &models, const CSAXOptions &options)
+{
+    char *buffer = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&buffer, &capacity, in)) > 0) {
+        string line(buffer, length);
+        while (!line.empty() &&
+                (line[line.length() - 1] == '\n' ||
+                 line[line.length() - 1] == '\r')) {
+            line.erase(line.length() - 1);
+        }
+        if (line.empty()) {
+            continue;
+        }
+        string reply = serveRequest(line, numGenes, gsea, models, options);
+        fprintf(out, "%s\n", reply.c_str());
+        fflush(out);
+    }
+    free(buffer);
+}
+
+/* Function serveCSAX:
+ * Resident scoring service. Loads the gene set database and the trained
+ * models of the full training set and of every bag (from the model
+ * directory, see -M; nothing is trained) once, then scores test samples
+ * sent one per line on stdin, or on a Unix domain socket at
+ * options.socket_path (one connection at a time), until killed
+ */
+/* SIGTERM/SIGINT handler of the socket service: shutting the listening
+ * socket down wakes accept(), and a client being served sees its read
+ * interrupted
+ */
+void stopServing(int)
+{
+    SERVE_STOP = 1;
+    if (SERVE_SOCKET >= 0) {
+        shutdown(SERVE_SOCKET, SHUT_RDWR);
+    }
+}
+
+void serveCSAX(const SampleMatrix &traindata, string genesets_file,
+        const CSAXOptions &options)
+{
+    if (options.model_dir == "") {
+        cerr << "--serve needs trained models (-M)" << endl;
+        exit(1);
+    }
+    FRaCData data;
+    data.train = samplesToProblem(traindata);
+    data.test = NULL;
+    data.geneNames = &traindata.getGeneNames();
+    frac_default_parameter(&data.param);
+    data.trainKeys = sampleKeys(traindata);
+    data.settingsKey = settingsKey(data.param, traindata.getGeneNames());
+    data.cache = NULL;
+    data.model_dir = makeDirectory(options.model_dir);
+    data.score_only = true;
+
+    GSEA gsea(genesets_file, traindata.getGeneNames());
+    unsigned numGenes = traindata.numGenes();
+
+    // Support vectors point into data.train, which stays for the service's
+    // lifetime; the bag views are only needed while loading
+    ServedModels models;
+    vector<Bag> bags(1, selectBag(traindata.numSamples(), 1, 0));
+    for (int b = 0; b < options.num_bags; b++) {
+        bags.push_back(selectBag(traindata.numSamples(), .5,
+                    options.seed + b));
+    }
+    for (unsigned b = 0; b < bags.size(); b++) {
+        svm_problem *prob_X = frac_view(data.train, bags[b].data(),
+                bags[b].size());
+        vector<frac_model> bagModels(numGenes);
+        if (!loadBagModels(data, bags[b], prob_X, bagModels)) {
+            cerr << "No trained models for " << (b ? "bag " +
+                    to_string(b - 1) : "the full training set") << " in "
+                 << data.model_dir << "; train them with -M first" << endl;
+            exit(1);
+        }
+        frac_free_view(prob_X);
+        (b == 0 ? models.full : models.bags).push_back(bagModels);
+    }
+    cerr << "Serving " << bags.size() - 1 << " bags of " << numGenes
+         << " gene models" << endl;
+
+    if (options.socket_path == "") {
+        serveStream(stdin, stdout, numGenes, gsea, models, options);
+    } else {
+        signal(SIGPIPE, SIG_IGN);
+        int server = socket(AF_UNIX, SOCK_STREAM, 0);
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (options.socket_path.length() >= sizeof(address.sun_path)) {
+            cerr << "Socket path too long: " << options.socket_path << endl;
+            exit(1);
+        }
+        strcpy(address.sun_path, options.socket_path.c_str());
+        unlink(options.socket_path.c_str());
+        if (server < 0 ||
+                bind(server, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+                listen(server, 16) < 0) {
+            cerr << "Could not listen on " << options.socket_path << endl;
+            exit(1);
+        }
+        // No SA_RESTART, so a signal interrupts accept() and client reads
+        SERVE_SOCKET = server;
+        struct sigaction stop;
+        memset(&stop, 0, sizeof(stop));
+        stop.sa_handler = stopServing;
+        sigemptyset(&stop.sa_mask);
+        sigaction(SIGTERM, &stop, NULL);
+        sigaction(SIGINT, &stop, NULL);
+        while (!SERVE_STOP) {
+            int client = accept(server, NULL, NULL);
+            if (client < 0) {
+                continue;
+            }
+            FILE *in = fdopen(client, "r");
+            FILE *out = fdopen(dup(client), "w");
+            if (in && out) {
+                serveStream(in, out, numGenes, gsea, models, options);
+            }
+            if (in) {
+                fclose(in);
+            }
+            if (out) {
+                fclose(out);
+            }
+        }
+        SERVE_SOCKET = -1;
+        close(server);
+        unlink(options.socket_path.c_str());
+        cerr << "Stopped serving on " << options.socket_path << endl;
+    }
+
+    for (unsigned b = 0; b < models.bags.size(); b++) {
+        for (unsigned j = 0; j < numGenes; j++) {
+            frac_free_model(&models.bags[b][j]);
+        }
+    }
+    for (unsigned j = 0; j < numGenes; j++) {
+        frac_free_model(&models.full[0][j]);
+    }
+    frac_free_problem(data.train);
+}
+
 /* Sets up the output directory */
 void initializeOutputDir(string output_dir)
 {
@@ -99,191 +487,515 @@ void initializeOutputDir(string output_dir)
     }
 }
 
-/* CSAX_iteration is passed all the data from runCSAX
- * Calls frac on the given train and test data. Gets results from frac, and
- * then calls GSEA on that frac output
+/* Prints one line of progress; bags log from several threads */
+void logLine(string line)
+{
+    lock_guard<mutex> lock(LOG_MUTEX);
+    cout << line << endl;
+}
+
+/* Runs CSAX_iteration on every bag, using jobs threads
+ * Every bag is a view of the shared training problem and its results stay
+ * in memory, so bags share nothing but the read-only inputs. Results are
+ * added to the manager in bag order as soon as all earlier bags are done, so
+ * the rankings (and the anomaly scores) are the same for any number of jobs.
+ * Every interim bags (0 for never) but the last, the scores of the bags
+ * added so far are taken with interim_scores under the merge lock, and
+ * passed to write_interim (with the number of bags) after it is released,
+ * so bags finishing meanwhile do not wait for the file to be written.
+ * Each bag's rankings are appended to the checkpoint when it finishes; bags
+ * the checkpoint already has are not run again.
  */
-void CSAX_iteration(SampleList traindata, SampleList testdata, string testfile,
-        string genesets_file, vector<GeneSetManager *> managers)
+void runBags(const FRaCData &data, GSEA &gsea, const vector<Bag> &bags,
+        GeneSetManager &manager, Checkpoint &checkpoint, unsigned jobs,
+        unsigned interim,
+        function<vector<double>(GeneSetManager &)> interim_scores,
+        function<void(unsigned, const vector<double> &)> write_interim)
 {
+    unsigned num_bags = bags.size();
+    vector<BagRankings> finished(num_bags);
+    vector<bool> ready(num_bags, false);
+    vector<unsigned> todo;
+    unsigned merged = 0;
+    mutex merge;
+    atomic<unsigned> next(0);
+
+    // Called under the merge lock; snapshots are the interim scores due
+    typedef vector<pair<unsigned, vector<double> > > Snapshots;
+    auto mergeReady = [&](Snapshots &snapshots) {
+        while (merged < num_bags && ready[merged]) {
+            addRankings(manager, finished[merged]);
+            BagRankings().swap(finished[merged]);
+            merged++;
+            if (interim > 0 && merged % interim == 0 && merged < num_bags) {
+                snapshots.push_back(make_pair(merged,
+                            interim_scores(manager)));
+            }
+        }
+    };
+    auto writeInterim = [&](Snapshots &snapshots) {
+        for (unsigned k = 0; k < snapshots.size(); k++) {
+            write_interim(snapshots[k].first, snapshots[k].second);
+        }
+    };
+
+    for (unsigned b = 0; b < num_bags; b++) {
+        if (checkpoint.bag(b, finished[b])) {
+            ready[b] = true;
+        } else {
+            todo.push_back(b);
+        }
+    }
+    if (todo.size() < num_bags) {
+        logLine("Resuming: " + to_string(num_bags - todo.size()) +
+                " bags done");
+    }
+    Snapshots resumed;
+    mergeReady(resumed);
+    writeInterim(resumed);
+
+    auto worker = [&]() {
+        unsigned t;
+        while ((t = next++) < todo.size()) {
+            unsigned b = todo[t];
+            logLine("Running csax on iteration: " + to_string(b));
+            BagRankings rankings = CSAX_iteration(data, gsea, bags[b]);
+
+            Snapshots snapshots;
+            {
+                lock_guard<mutex> lock(merge);
+                checkpoint.writeBag(b, rankings);
+                finished[b].swap(rankings);
+                ready[b] = true;
+                mergeReady(snapshots);
+            }
+            writeInterim(snapshots);
+        }
+    };
+
+    // a thread whose queue is drained gives its share of the -j budget to
+    // the kernel columns of the bags still running (svm_set_num_threads);
+    // this one's is taken back once they are done
+    vector<thread> pool;
+    for (unsigned t = 1; t < jobs && t < todo.size(); t++) {
+        svm_hold_threads(1);
+        pool.push_back(thread([&]() { worker(); svm_release_threads(1); }));
+    }
+    worker();
+    svm_release_threads(1);
+    for (unsigned t = 0; t < pool.size(); t++) {
+        pool[t].join();
+    }
+    svm_hold_threads(1);
+}
+
+/* CSAX_iteration is passed all the data from runCSAX and one bag
+ * Calls frac on the bag of train data and the test data. Gets results from
+ * frac, and then calls GSEA on that frac output
+ * Returns the gene sets of each test sample in rank order
+ */
+BagRankings CSAX_iteration(const FRaCData &data, GSEA &gsea,
+        const Bag &bag)
+{
+    ProfileScope scope("bag");
 
     // Run FRaC on sample of traindata
-    vector<GeneScoreList *> genescores =
-        runFRaC(traindata, testfile, false);
+    SurprisalScores ns = bagSurprisal(data, bag);
 
     // Run GSEA on output
-    vector<map<string, double> *> enrichmentscores =
-        runGSEA(genesets_file, genescores);
+    EnrichmentScores enrichmentscores = runGSEA(gsea, ns);
 
-    int rank;
+    ProfileScope rankScope("ranking");
+    BagRankings rankings(enrichmentscores.size());
     // For each test sample
-    for (unsigned i = 0; i < testdata.data.size(); i++) {
-        rank = 1; // TODO: Check if first rank should be 1 or 0
-        for (std::map<string, double>::iterator it=enrichmentscores[i]->begin();
-                it != enrichmentscores[i]->end(); it++) {
-            managers[i]->addRankingToGeneset(rank++, it->first);
+    for (unsigned i = 0; i < enrichmentscores.size(); i++) {
+        rankings[i] = rankGeneSets(enrichmentscores[i], gsea);
+    }
+    return rankings;
+}
+
+/* The ids of the gene sets with an enrichment score (not NaN), most
+ * enriched first; ties are ranked by name
+ */
+vector<unsigned> rankGeneSets(const vector<double> &ES, const GSEA &gsea)
+{
+    vector<unsigned> ranked;
+    for (unsigned s = 0; s < ES.size(); s++) {
+        if (!std::isnan(ES[s])) {
+            ranked.push_back(s);
         }
     }
+    sort(ranked.begin(), ranked.end(), [&ES, &gsea](unsigned a, unsigned b)
+            { return ES[a] != ES[b] ? ES[a] > ES[b] :
+                gsea.getName(a) < gsea.getName(b); });
+    return ranked;
 }
 
-/* Takes in the training data and a file pointer to the test data
- * Creates a traindata file, passes in that file and the testfile to Frac
- * Parses the outputfile from Frac and returns it as a list of GeneScoreLists
+/* Runs the items of the queue no worker has claimed yet (with --reclaim, also
+ * those of workers of this host that died), using jobs threads:
+ * the full training set (and its GSEA reports, with -P) and then the bags,
+ * each published in the queue for reduceQueue as soon as it is done
  */
-vector<GeneScoreList *> runFRaC(SampleList traindata, string testfile,
-        bool use_all)
+void runWorker(const FRaCData &data, GSEA &gsea, const Bag &full,
+        const vector<Bag> &bags, WorkQueue &queue, const CSAXOptions &options,
+        const SampleMatrix &testdata)
 {
-    (void)testfile;
-    string trainfile = "trainfile";
-    if (use_all) {
-        samplesToFile(traindata, trainfile, 1);
-    } else {
-        samplesToFile(traindata, trainfile, .5);
+    atomic<unsigned> next(0);
+
+    auto worker = [&]() {
+        unsigned item;
+        // item 0 is the full training set, item b + 1 is bag b
+        while ((item = next++) <= bags.size()) {
+            if (item == 0) {
+                if (!queue.claim(WorkQueue::FULL_SET) &&
+                        !(options.reclaim &&
+                            queue.reclaim(WorkQueue::FULL_SET))) {
+                    continue;
+                }
+                logLine("Running csax on the whole training set");
+                SurprisalScores ns = bagSurprisal(data, full);
+                queue.finishFullSet(runGSEA(gsea, ns));
+                if (options.nperm > 0) {
+                    writeGSEAReports(gsea, ns, testdata);
+                }
+                continue;
+            }
+            unsigned b = item - 1;
+            if (!queue.claim(b) && !(options.reclaim && queue.reclaim(b))) {
+                continue;
+            }
+            logLine("Running csax on iteration: " + to_string(b));
+            queue.finishBag(b, CSAX_iteration(data, gsea, bags[b]));
+        }
+    };
+
+    // shares of the -j budget as in runBags
+    vector<thread> pool;
+    for (unsigned t = 1; t < options.jobs && t <= bags.size(); t++) {
+        svm_hold_threads(1);
+        pool.push_back(thread([&]() { worker(); svm_release_threads(1); }));
+    }
+    worker();
+    svm_release_threads(1);
+    for (unsigned t = 0; t < pool.size(); t++) {
+        pool[t].join();
     }
+    svm_hold_threads(1);
+}
 
-    cout << "Calling FRaC" << endl;
-    string command = "./frac.r " + trainfile + " " + testfile + " FRaC_output";
-    system(command.c_str());
-    string fracFileP = "output_location/ns.gz";
-    command = "gzip -d " + fracFileP;
-    system(command.c_str());
+/* Reads the full training set and the first num_bags bags from the queue and
+ * adds the bags to the manager in bag order; exits naming what is missing
+ * (and who claimed it) if the workers are not done
+ */
+void reduceQueue(WorkQueue &queue, unsigned num_bags, GeneSetManager &manager,
+        EnrichmentScores &ES)
+{
+    vector<unsigned> missing;
+    if (!queue.fullSet(ES)) {
+        missing.push_back(WorkQueue::FULL_SET);
+    }
+    for (unsigned b = 0; b < num_bags; b++) {
+        BagRankings rankings;
+        if (queue.bag(b, rankings)) {
+            addRankings(manager, rankings);
+        } else {
+            missing.push_back(b);
+        }
+    }
+    if (missing.empty()) {
+        return;
+    }
+    cerr << "The workers are not done with:" << endl;
+    for (unsigned k = 0; k < missing.size(); k++) {
+        string owner = queue.owner(missing[k]);
+        cerr << "  " << (missing[k] == WorkQueue::FULL_SET ?
+                string("the whole training set") :
+                "bag " + to_string(missing[k]))
+             << (owner == "" ? ", not claimed" : ", claimed by " + owner)
+             << endl;
+    }
+    exit(1);
+}
 
+/* Adds one bag's rankings of each test sample to the gene set manager */
+void addRankings(GeneSetManager &manager, const BagRankings &rankings)
+{
+    ProfileScope scope("aggregation");
+    for (unsigned i = 0; i < rankings.size(); i++) {
+        manager.addRankings(i, rankings[i]);
+    }
+}
 
-    string decompfracFileP = OUTPUT_DIR + "ns";
+/* Writes the anomaly score of every test sample, from the rankings added to
+ * the manager so far
+ */
+void writeScores(GeneSetManager &manager, const EnrichmentScores &ES,
+        const SampleMatrix &testdata, double gamma, unsigned jobs,
+        string output_file)
+{
+    writeScoreFile(manager.getAnomalyScores(gamma, ES, jobs), testdata,
+            output_file);
+}
 
-    vector<GeneScoreList *> genescores = parseFRaCOutput(decompfracFileP);
+/* Writes the anomaly score of every test sample */
+void writeScoreFile(const vector<double> &scores,
+        const SampleMatrix &testdata, string output_file)
+{
+    ofstream f;
+    f.open(output_file);
 
-    //need to remove FRaC's files otherwise it will reuse them the next
-    //iteration
-    remove(fracFileP.c_str());
-    remove(decompfracFileP.c_str());
+    for (unsigned i = 0;i  < testdata.numSamples(); i++) {
+        f << testdata.getName(i) << "\t" << scores[i] << "\n";
+    }
 
-    return genescores;
+    f.close();
 }
 
-/* Parses the GSEA output, returns it in a map representation
+/* Takes in the shared FRaC problems, a bag of the training data and some of
+ * the test samples
+ * Runs the FRaC library (frac/libfrac.a) on views of the bag's rows of the
+ * training problem and of the tests' rows of the test problem; no sample
+ * data is copied
+ * With a model directory, the bag's feature models are loaded from it if
+ * they were saved before (so only prediction runs), and saved to it
+ * otherwise
+ * Returns the normalized surprisal of every gene for each of the tests
  */
-map<string, double> *parseGSEAOutput(string gseaFileP)
+SurprisalScores runFRaC(const FRaCData &data, const Bag &bag,
+        const vector<int> &tests)
 {
-    map<string, double> *inputBuffer;
-    ifstream matrix;
-    matrix.open(gseaFileP);
-    string line = "";
-    string genesetname;
-    double score;
-    string junk;
-    if (matrix.is_open()) {
-        //Don't need the header, just call getline to remove it
-        getline(matrix, line);
-        inputBuffer = new map<string, double>;
-        while (matrix >> genesetname) {
-            matrix >> junk >> junk >> score >> junk >> junk >> junk >> junk >> junk >> junk >> junk >> junk;
-            (*inputBuffer)[genesetname] = score;
+    svm_problem *prob_X;
+    svm_problem *prob_Q;
+    {
+        ProfileScope scope("bag_materialize");
+        prob_X = frac_view(data.train, bag.data(), bag.size());
+        prob_Q = frac_view(data.test, tests.data(), tests.size());
+    }
+
+    unsigned numGenes = data.geneNames->size();
+    unsigned numTests = tests.size();
+    vector<double> ns(numGenes * numTests);
+
+    vector<frac_model> models(numGenes);
+    if (data.model_dir != "" && loadBagModels(data, bag, prob_X, models)) {
+        logLine("Loaded FRaC models");
+    } else {
+        if (data.score_only) {
+            cerr << "No trained models for a bag in " << data.model_dir
+                 << "; train them with -M without --score first" << endl;
+            exit(1);
+        }
+        logLine("Calling FRaC");
+        for (unsigned j = 0; j < numGenes; j++) {
+            ProfileScope scope("frac_train");
+            frac_train(prob_X, NULL, j + 1, &data.param, &models[j]);
         }
+        if (data.model_dir != "") {
+            saveBagModels(data, bag, prob_X, models);
+        }
+    }
+    for (unsigned j = 0; j < numGenes; j++) {
+        ProfileScope scope("surprisal");
+        frac_score(&models[j], prob_Q, ns.data() + j * numTests);
+        frac_free_model(&models[j]);
     }
-    return inputBuffer;
+
+    frac_free_view(prob_X);
+    frac_free_view(prob_Q);
+
+    SurprisalScores scores(numTests, vector<double>(numGenes));
+    for (unsigned j = 0; j < numGenes; j++) {
+        for (unsigned i = 0; i < numTests; i++) {
+            scores[i][j] = ns[j * numTests + i];
+        }
+    }
+
+    return scores;
 }
 
-/* Parses FRaC output from a given fileponter
+/* The normalized surprisal of every test sample under a bag, from the cache
+ * where possible: FRaC only runs for the test samples that are not cached
+ * (and not at all if every one is, unless the bag's models are to be saved)
+ * An entry's key hashes the FRaC settings, the gene names, the bag's
+ * training samples and the test sample, so it is found again by any run
+ * with the same data in that bag, whatever its gamma, bag count or other
+ * test samples
  */
-vector<GeneScoreList *> parseFRaCOutput(string fracFileP)
+SurprisalScores bagSurprisal(const FRaCData &data, const Bag &bag)
 {
-    vector<GeneScoreList *> inputBuffer;
-    ifstream matrix;
-    matrix.open(fracFileP);
-    string line = "";
-    string name;
-
-    vector<string> nameGenes;
-    double tempdouble = 0.0;
-    unsigned numNames = 0;
-    GeneScoreList * p;
-    if (matrix.is_open()) {
-        //Don't need the header, just call getline to remove it
-        getline(matrix, line);
-        istringstream lineStream (line);
-        while (lineStream >> name) {
-            numNames++;
-         }
-        while (matrix >> name) {
-            vector<double> oneRow;
-            for (unsigned i = 0; i < numNames; i++) {
-                matrix >> tempdouble;
-                oneRow.push_back(tempdouble);
+    unsigned numTests = data.test->l;
+    SurprisalScores scores(numTests);
+    vector<uint64_t> keys(numTests);
+    vector<int> missing;
+
+    if (data.cache) {
+        uint64_t key = bagKey(data, bag);
+        for (unsigned i = 0; i < numTests; i++) {
+            keys[i] = fnv1a(&data.testKeys[i], sizeof(uint64_t), key);
+            if (!data.cache->load(keys[i], scores[i]) ||
+                    scores[i].size() != data.geneNames->size()) {
+                missing.push_back(i);
             }
-            p = new GeneScoreList;
-            p->gene = name;
-            p->scores = oneRow;
-            inputBuffer.push_back(p);
+        }
+        logLine(to_string(numTests - missing.size()) + " of " +
+                to_string(numTests) + " test samples cached");
+    } else {
+        for (unsigned i = 0; i < numTests; i++) {
+            missing.push_back(i);
+        }
+    }
+    if (missing.empty()) {
+        // With a model directory the bag's models are still trained and
+        // saved (for no test sample) if they were not saved before
+        if (data.model_dir != "" && !data.score_only &&
+                access(bagModelFile(data, bag).c_str(), F_OK) != 0) {
+            runFRaC(data, bag, missing);
+        }
+        return scores;
+    }
+
+    SurprisalScores computed = runFRaC(data, bag, missing);
+    for (unsigned k = 0; k < missing.size(); k++) {
+        scores[missing[k]].swap(computed[k]);
+        if (data.cache) {
+            data.cache->store(keys[missing[k]], scores[missing[k]]);
         }
     }
-    return inputBuffer;
+    return scores;
 }
 
-/* Given the output from frac (genescores) and the genesets_file (like
- * reactome), returns the output from GSEA in an internal representation
+/* Hash of the FRaC settings, the genes and the bag's training samples: what
+ * the bag's feature models depend on
  */
-vector<map<string, double>*> runGSEA(string genesets_file,
-        vector<GeneScoreList *> genescores)
+uint64_t bagKey(const FRaCData &data, const Bag &bag)
 {
-    (void)genesets_file;
-    (void)genescores;
-    string inputfile;
-    vector<map<string, double>*> enrichment_scores;
-    string outputfolder;
-    string gseajar = "gsea/gsea.jar";
-    unsigned num_tests = genescores[0]->scores.size();
-    for (unsigned i = 0; i < num_tests; i++) {
-        inputfile = "gseainput" + std::to_string(i + 1) + ".rnk";
-        writeGSEAInput(genescores, i, inputfile);
-
-        outputfolder = "output_location/gsea_output";
-
-
-        /*GSEA has an ugly input command */
-        string cmd = "java -cp " + gseajar + " -Xmx1g xtools.gsea.GseaPreranked -gmx " + genesets_file + " -rnk " + inputfile + " -out " + outputfolder + " -rnd_seed 9141976 -rpt_label csax -collapse false -mode Max_probe -norm meandiv -nperm 1000 -scoring_scheme weighted -include_only_symbols true -make_sets false -plot_top_x 0 -set_max 500 -set_min 7 -zip_report false -gui false 1>/dev/null ";
-
-        cout << "calling GSEA" << endl;
-        system(cmd.c_str());
-
-        DIR *directory = opendir(outputfolder.c_str());
-        struct dirent *entry;
-        if (directory == NULL) {
-            cerr << "No gsea output... Abort!" << endl;
-            exit(1);
-        }
-        while ((entry = readdir(directory)) != NULL) {
-            if (entry->d_name[0] == 'c') {
-                break;
-            }
-        }
-        string suffix = string(entry->d_name).substr(19);
-        string gseaoutput = outputfolder + "/" + entry->d_name +
-            "/gsea_report_for_na_pos_" + suffix + ".xls";
+    uint64_t key = data.settingsKey;
+    for (unsigned k = 0; k < bag.size(); k++) {
+        key = fnv1a(&data.trainKeys[bag[k]], sizeof(uint64_t), key);
+    }
+    return key;
+}
+
+/* File of the feature models of a bag in the model directory */
+string bagModelFile(const FRaCData &data, const Bag &bag)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.models",
+            (unsigned long long)bagKey(data, bag));
+    return data.model_dir + name;
+}
+
+/* Loads the feature models of a bag (trained on prob_X, the bag's view of
+ * the training problem), if they were saved
+ */
+bool loadBagModels(const FRaCData &data, const Bag &bag,
+        const svm_problem *prob_X, vector<frac_model> &models)
+{
+    ProfileScope scope("model_io");
+    FILE *f = fopen(bagModelFile(data, bag).c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    bool loaded = frac_load_models(f, models.data(), models.size(),
+            prob_X) == 0;
+    fclose(f);
+    return loaded;
+}
+
+/* Saves the feature models of a bag; written to a temporary file and
+ * renamed, like cache entries
+ */
+void saveBagModels(const FRaCData &data, const Bag &bag,
+        const svm_problem *prob_X, const vector<frac_model> &models)
+{
+    ProfileScope scope("model_io");
+    string final_path = bagModelFile(data, bag);
+    hash<thread::id> thread_hash;
+    string temp_path = final_path + ".tmp." + to_string(getpid()) + "." +
+        to_string(thread_hash(this_thread::get_id()));
+    FILE *f = fopen(temp_path.c_str(), "wb");
+    bool saved = f && frac_save_models(f, models.data(), models.size(),
+            prob_X) == 0;
+    if (f && fclose(f) != 0) {
+        saved = false;
+    }
+    if (!saved || rename(temp_path.c_str(), final_path.c_str()) != 0) {
+        cerr << "Warning: could not save models to " << final_path << endl;
+        remove(temp_path.c_str());
+    }
+}
+
+/* Hash of each sample's name and values, for cache keys */
+vector<uint64_t> sampleKeys(const SampleMatrix &samples)
+{
+    vector<uint64_t> keys(samples.numSamples());
+    for (unsigned i = 0; i < samples.numSamples(); i++) {
+        SampleView sample = samples.sample(i);
+        keys[i] = fnv1a(*sample.name);
+        keys[i] = fnv1a(sample.genes, sample.genecount * sizeof(double),
+                keys[i]);
+    }
+    return keys;
+}
 
-        enrichment_scores.push_back(parseGSEAOutput(gseaoutput));
-        cmd = "rm -r " + outputfolder;
-        system(cmd.c_str());
-        remove(inputfile.c_str());
+/* Hash of what FRaC results depend on besides the samples: the FRaC
+ * parameters and the genes
+ */
+uint64_t settingsKey(const svm_parameter &param,
+        const vector<string> &geneNames)
+{
+    ostringstream settings;
+    settings.precision(17);
+    settings << "frac ns 1 " << param.svm_type << " " << param.kernel_type
+             << " " << param.degree << " " << param.gamma << " "
+             << param.coef0 << " " << param.C << " " << param.eps << " "
+             << param.p << " " << param.shrinking << " " << param.folds
+             << " " << param.timeout;
+    uint64_t key = fnv1a(settings.str());
+    for (unsigned j = 0; j < geneNames.size(); j++) {
+        key = fnv1a(geneNames[j], key);
+    }
+    return key;
+}
+
+/* Given the output from frac (ns) and the gene set database (like
+ * reactome), returns the GSEA enrichment scores of each test sample
+ */
+EnrichmentScores runGSEA(GSEA &gsea, const SurprisalScores &ns)
+{
+    EnrichmentScores enrichment_scores;
+    logLine("calling GSEA");
+    for (unsigned i = 0; i < ns.size(); i++) {
+        ProfileScope scope("enrichment");
+        enrichment_scores.push_back(gsea.enrichmentScores(ns[i]));
     }
 
     return enrichment_scores;
 }
 
-/* Writes a sample list to file
- * Used to create an input file for a FRaC call
- * Randomly chooses percent_to_add of the queries to write to file
+/* Writes a GSEA report (with NES and nominal p-values from options.nperm
+ * permutations) of every test sample to output_dir/gsea_report.<sample>
  */
-void samplesToFile(SampleList samples, string filename, double percent_to_add)
+void writeGSEAReports(GSEA &gsea, const SurprisalScores &ns,
+        const SampleMatrix &testdata)
+{
+    cout << "writing GSEA reports" << endl;
+    for (unsigned i = 0; i < testdata.numSamples(); i++) {
+        gsea.writeReport(ns[i],
+                OUTPUT_DIR + "gsea_report." + testdata.getName(i));
+    }
+}
+
+/* Randomly chooses percent_to_add of numTraining samples, with a generator
+ * seeded with seed
+ * Returns the indices of the chosen samples, in sample order
+ */
+Bag selectBag(unsigned numTraining, double percent_to_add, unsigned seed)
 {
-    ofstream f;
     double fractionBag = percent_to_add;
-    unsigned numTraining = samples.data.size();
     unsigned numTrue = fractionBag * numTraining;
     vector<bool> truthVector;
 
-    f.open(filename);
-
     //make a random permutation parallel array
     for (unsigned i = 0; i < numTrue; i++) {
         truthVector.push_back(true);
@@ -291,39 +1003,34 @@ void samplesToFile(SampleList samples, string filename, double percent_to_add)
     for (unsigned i = numTrue; i < numTraining; i++) {
         truthVector.push_back(false);
     }
-    std::random_shuffle (truthVector.begin(), truthVector.end());
+    mt19937 rng(seed);
+    std::shuffle (truthVector.begin(), truthVector.end(), rng);
 
-    //output training data to a file
-    for (unsigned i = 0; i < samples.data.size(); i++) {
+    Bag bag;
+    for (unsigned i = 0; i < numTraining; i++) {
         if (truthVector[i]) {
-            f << samples.data[i]->getName() << "\t";
-        }
-    }
-    f << endl;
-
-    unsigned numGenes = samples.geneNames.size();
-    for (unsigned j = 0; j < numGenes; j++) {
-        f << samples.geneNames[j] << "\t";
-        for (unsigned i = 0; i < samples.data.size(); i++) {
-            if (truthVector[i])
-                f << samples.data[i]->getGene(j) << "\t";
+            bag.push_back(i);
         }
-        f << endl;
     }
-
-    f.close();
+    return bag;
 }
 
-/* Given one index, writes one genescore to a file to be used with GSEA
+/* Builds a FRaC problem (rows are samples, columns are genes) from all the
+ * samples of a sample matrix; both are sample-major, so each row is one
+ * sequential read
  */
-void writeGSEAInput(vector<GeneScoreList *> genescores, unsigned index,
-        string filename)
+svm_problem *samplesToProblem(const SampleMatrix &samples)
 {
-    ofstream f;
-    f.open(filename);
-    for (unsigned i = 0; i < genescores.size(); i++) {
-        f << genescores[i]->gene << '\t'
-          << genescores[i]->scores[index] << endl;
+    unsigned numSamples = samples.numSamples();
+    unsigned numGenes = samples.numGenes();
+    svm_problem *prob = frac_alloc_problem(numSamples, numGenes);
+    for (unsigned i = 0; i < numSamples; i++) {
+        SampleView sample = samples.sample(i);
+        svm_node *row = prob->x[i];
+        for (unsigned j = 0; j < numGenes; j++) {
+            row[j].value = sample[j];
+        }
     }
-    f.close();
+
+    return prob;
 }
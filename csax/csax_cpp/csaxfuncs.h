@@ -2,18 +2,40 @@
 // April 2015
 // Helper function declarations for the CSAX algorithm
 
+#ifndef CSAXFUNCS_H
+#define CSAXFUNCS_H
+
 #include "sample.h"
+#include <string>
 #include <vector>
 #include <iostream>
 using namespace std;
 
 struct GeneScorePair;
 
-struct SampleList {
-    vector<Sample *> data;
-    vector<string> geneNames;
+/*settings of a CSAX run, set from the command line in main.cpp */
+struct CSAXOptions {
+    int num_bags;   // number of bagging iterations (-B)
+    double gamma;   // discount of lower ranked gene sets
+    unsigned nperm; // GSEA permutations for the reports only (-P, 0 = none)
+    unsigned jobs;  // bags to run at once (-j)
+    unsigned interim; // write scores every this many bags (-I, 0 = never)
+    unsigned seed;    // bag b is drawn with seed + b (-S)
+    string cache_dir; // FRaC result cache (-K, "" = none)
+    bool resume;      // continue from output_dir/csax_checkpoint (--resume)
+    string model_dir; // trained bag models to load or save (-M, "" = none)
+    bool score_only;  // only use models from model_dir, never train (--score)
+    string socket_path; // --serve listens here ("" = stdin/stdout) (-U)
+    unsigned top_sets;  // gene sets reported per sample by --serve (-T)
+    bool worker;  // run bags claimed from output_dir/queue (--worker)
+    bool reduce;  // score the bags the workers finished (--reduce)
+    bool reclaim; // also run items of dead workers of this host (--reclaim)
 };
 
 /*only one public function, see class for details */
-void runCSAX(SampleList traindata, SampleList testdata, string testfile,
-        string genesets_file, string output_dir, int num_bags, double gamma);
+void runCSAX(const SampleMatrix &traindata, const SampleMatrix &testdata,
+        string genesets_file, string output_dir, const CSAXOptions &options);
+void serveCSAX(const SampleMatrix &traindata, string genesets_file,
+        const CSAXOptions &options);
+
+#endif
@@ -0,0 +1,928 @@
+/*
+
+	FRaC library (see fraclib.h)
+
+	The feature loop is the one from mad.frac's main.cpp, which now calls
+	into this file as well.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include "fraclib.h"
+
+#define Malloc(type,n) (type *)malloc((n)*sizeof(type))
+
+void frac_default_parameter(svm_parameter *svm_param) {
+
+	svm_param->svm_type = EPSILON_SVR; // default for frac.libsvr is EPSILON_SVR, not C_SVC
+	svm_param->kernel_type = LINEAR; // noto changed default from RBF
+	svm_param->degree = 3;
+	svm_param->gamma = 0;	// 1/num_features
+	svm_param->coef0 = 0;
+	svm_param->nu = 0.5;
+	svm_param->cache_size = 100;
+	svm_param->C = 1;
+	svm_param->eps = 1e-3;
+	svm_param->p = 0.0;	// noto changed default from 0.1
+	svm_param->shrinking = 1;
+	svm_param->probability = 0;
+	svm_param->nr_weight = 0;
+	svm_param->weight_label = NULL;
+	svm_param->weight = NULL;
+	svm_param->timeout = 86400;
+	svm_param->mask_feature = 0;
+	svm_param->dense = NULL;
+
+	svm_param->X_file =
+	svm_param->V_file =
+	svm_param->Q_file = NULL;
+	svm_param->folds = 0; // zero will be interpreted later as leave-one-out
+	svm_param->f1 = 1;
+	svm_param->fD = 0; // zero will later be interpreted as number-of-features
+	svm_param->gram = 0;
+	svm_param->ridge = 0;
+
+}
+
+// One block of nodes for the whole problem, so freeing is two calls
+svm_problem* frac_alloc_problem(int l, int d) {
+
+	svm_problem *prob = Malloc(svm_problem, 1);
+	svm_node *nodes = Malloc(svm_node, (size_t)l * (d+1));
+
+	prob->l = l;
+	prob->y = Malloc(double, l);
+	prob->x = Malloc(svm_node*, l);
+
+	for (int i=0; i<l; i++) {
+		svm_node *row = nodes + (size_t)i * (d+1);
+		for (int j=0; j<d; j++) {
+			row[j].index = j+1;
+			row[j].value = 0.0;
+		}
+		row[d].index = -1;
+		row[d].value = 0.0;
+		prob->x[i] = row;
+		prob->y[i] = 0;
+	}
+
+	return prob;
+}
+
+void frac_free_problem(svm_problem *prob) {
+	if (!prob) { return; }
+	if (prob->l > 0) { free(prob->x[0]); }
+	free(prob->x);
+	free(prob->y);
+	free(prob);
+}
+
+// count features in a problem
+int count_features(const svm_problem *prob, const int lower_bound) {
+
+	int d = lower_bound; // return value, d = number of features
+
+	for (int i=0; i<prob->l; i++) {
+		for (svm_node *p = prob->x[i]; p->index > 0; p++) {
+			d = p->index > d ? p->index : d;
+		}
+	}
+
+	return d;
+}
+
+void target_values( const svm_problem *prob, int feature, double *y ) {
+	for (int i=0; i<prob->l; i++) {
+		y[i] = 0;
+		for (const svm_node *x = prob->x[i]; x->index > 0 && x->index <= feature; x++) { // indices ascend
+			if (x->index == feature) {
+				y[i] = x->value;
+				break;
+			}
+		}
+	}
+}
+
+// make predictions given a model and svm_problem.
+// Return malloc'ed and populated array of predictions.
+double* predict_set( const svm_model *model, const svm_problem *prob ) {
+
+	double *P = (double*)(malloc(sizeof(double) * prob->l));  // P is predictions
+	for (int i=0; i<prob->l; i++) {
+		P[i] = svm_predict(model, prob->x[i]);
+	}
+	return P;
+
+}
+
+// run cross-validation to make predicitions
+// return dynamically allocated array of predictions
+//	parallel to prob_X->y
+double* cross_validation(const svm_problem *prob_X, const svm_parameter *svm_param) {
+
+	double *predictions = (double*) malloc(sizeof(double) * prob_X->l);
+
+	svm_problem TP, TU; // train prime, tune (temporary organization storage)
+	TP.x = (svm_node**) malloc(sizeof(svm_node*) * prob_X->l);
+	TU.x = (svm_node**) malloc(sizeof(svm_node*) * prob_X->l);
+	TP.y = (double*) malloc(sizeof(double) * prob_X->l);
+	TU.y = (double*) malloc(sizeof(double) * prob_X->l);
+
+	const int folds = svm_param->folds ? svm_param->folds : prob_X->l; // if svm_param->folds is zero, use leave-one-out
+
+	for (int fold=0; fold < folds; fold++) {
+
+		// divide x and y into stratified train/test sets.  I use a stratified strategy:
+		// put every Nth instance in tune set, starting with fold index.
+		TP.l = TU.l = 0;
+		for (int i=0; i<prob_X->l; i++) {
+			svm_problem *T = (i%(folds)==fold) ? &TU : &TP;
+			T->y[T->l] = prob_X->y[i];
+			T->x[T->l] = prob_X->x[i];
+			T->l = T->l + 1;
+		}
+
+		// train and predict
+		svm_model *model = svm_train(&TP, svm_param);
+		double *fold_predictions = predict_set(model, &TU);
+
+		// copy prediction back to appropriate place in output array
+		int f = 0; //  index in fold_predictions
+		for (int i=0; i<prob_X->l; i++) {
+			if (i%(folds)==fold) { predictions[i] = fold_predictions[f++]; }
+		}
+
+		// fold models used to leak; that adds up when the library stays
+		// resident across many calls
+		free(fold_predictions);
+		svm_free_and_destroy_model(&model);
+
+	}
+
+	free(TP.x); free(TP.y); free(TU.x); free(TU.y);
+
+	return predictions;
+}
+
+// private copy of a problem's row pointers with y set to the feature's values
+static svm_problem target_problem( const svm_problem *prob, int feature ) {
+	svm_problem T;
+	T.l = prob->l;
+	T.x = prob->x;
+	T.y = Malloc(double, prob->l);
+	target_values(prob, feature, T.y);
+	return T;
+}
+
+// the error model and entropy of feature i from cnt_v validation values and their predictions
+static void fit_error_model(frac_model *fm, int i, const double *y_v, const double *g_v, int cnt_v) {
+
+	// compute cnt_v errors from cnt_v predictions
+	double *errors = Malloc(double, cnt_v);
+	for (int v=0; v<cnt_v; v++) {
+		errors[v] = g_v[v] - y_v[v];
+	}
+
+	// model feature distribution
+	fm->feature = i;
+	fm->entropy = entropy(y_v, cnt_v); // the entropy of feature i
+
+	// model the predictive error
+	fm->error = model_error(errors, cnt_v);
+	free(errors);
+
+}
+
+// train the model of feature i on problems whose y is the feature's values
+static void train_targets(const svm_problem *prob_X, const svm_problem *prob_V,
+	int i, const svm_parameter *svm_param, frac_model *fm) {
+
+	// train model
+	svm_model *model = svm_train(prob_X, svm_param);
+
+	// make predictions on validation set
+	int cnt_v; // number of observations/predictions (depends on if if the validation set is given separately)
+	const double *y_v; // cnt_v observations (initialized below)
+	double *g_v; // cnt_v predictions (initialized below)
+
+	if (prob_V) {
+
+		// Validation set was given explicitly, so we simply use the model
+		// to make predictions
+		cnt_v = prob_V -> l;
+		y_v = prob_V->y;
+		g_v  = predict_set(model, prob_V);
+
+	} else {
+
+		// otherwise, use cross-validation to create a validation set from
+		// training set examples and make predictions.  Leave-one-out folds
+		// start from the model just trained, so each takes a few solver steps
+		cnt_v = prob_X->l;
+		y_v = prob_X->y;
+		if (svm_param->folds == 0 && svm_param->svm_type == EPSILON_SVR) {
+			g_v = Malloc(double, cnt_v);
+			svm_leave_one_out( prob_X, svm_param, model, g_v );
+		} else {
+			g_v = cross_validation( prob_X, svm_param );
+		}
+
+	}
+
+	fit_error_model(fm, i, y_v, g_v, cnt_v);
+	free(g_v);
+
+	fm->svm = model;
+
+}
+
+void frac_train(const svm_problem *shared_X, const svm_problem *shared_V,
+	int i, const svm_parameter *shared_param, frac_model *fm) {
+
+	// feature i is the target: it is copied to y and masked out of the kernel
+	svm_parameter param = *shared_param;
+	param.mask_feature = i;
+
+	svm_problem X = target_problem(shared_X, i), V;
+	svm_problem *prob_V = NULL;
+	if (shared_V) { V = target_problem(shared_V, i); prob_V = &V; }
+
+	train_targets(&X, prob_V, i, &param, fm);
+
+	free(X.y);
+	if (prob_V) { free(V.y); }
+
+}
+
+// normalized surprisal of l test instances whose feature values are y_t, predicted as g_t
+static void surprisal(const frac_model *fm, const double *y_t, const double *g_t, int l, double *ns) {
+
+	// normalized surprisal of each (0-origin) test instance index q
+	for (int q=0; q<l; q++) {
+
+		double y = y_t[q];
+		double g = g_t[q];
+		double p = likelihood( g-y, fm->error ); // p(x_i = g | C_i, x\x_i)
+		double s = -lg(p);		// surprisal
+		if (p==0 || isnan(p)) {
+			fprintf(stderr, "Warning:  probability of test instance #%d underflowed.\n", q+1);
+			s = MAX_SURPRISAL; // don't let surprisal <- inf because of underflow (prob. density of Gaussian can't truly be zero)
+		}
+		double n_s = s - fm->entropy; // normalized surprisal
+		if (n_s > MAX_NORMALIZED_SURPRISAL) {
+			fprintf(stderr, "Warning:  normalized surprisal of test instance #%d overflowed.\n", q+1);
+			n_s = MAX_NORMALIZED_SURPRISAL;
+		}
+		ns[q] = n_s;
+
+	}
+
+}
+
+// normalized surprisal of the test instances of a problem whose y is the model's feature
+static void score_targets(const frac_model *fm, const svm_problem *prob_Q, double *ns) {
+
+	// make predictions on test set; a linear model is collapsed for the set
+	// only (collapsing costs about one prediction), as every resident model
+	// keeping a weight per feature would take memory quadratic in the features
+	svm_model collapsed = *fm->svm;
+	collapsed.w = NULL;
+	if (prob_Q->l > 1) { svm_collapse_linear(&collapsed); }
+	double *g_t = predict_set( &collapsed, prob_Q );
+	free(collapsed.w);
+	surprisal(fm, prob_Q->y, g_t, prob_Q->l, ns);
+	free(g_t);
+
+}
+
+void frac_score(const frac_model *fm, const svm_problem *shared_Q, double *ns) {
+
+	svm_problem Q = target_problem(shared_Q, fm->feature);
+	score_targets(fm, &Q, ns);
+	free(Q.y);
+
+}
+
+void frac_free_model(frac_model *fm) {
+	svm_free_and_destroy_model(&fm->svm);
+}
+
+void frac_feature(const svm_problem *shared_X, const svm_problem *shared_V, const svm_problem *shared_Q,
+	int i, const svm_parameter *shared_param, double *ns) {
+
+	frac_model fm;
+	frac_train(shared_X, shared_V, i, shared_param, &fm);
+	frac_score(&fm, shared_Q, ns);
+	frac_free_model(&fm);
+
+}
+
+struct frac_gram {
+	int n, v, q;		// instances of X, V (0 without one) and Q
+	double *XX;		// n x n dot products
+	double *VX;		// v x n
+	double *QX;		// q x n
+	double *X_sq, *V_sq, *Q_sq;	// squared norm of each instance
+};
+
+// dense copy of a problem's first d features, l x d (d x l if transpose)
+static double* dense_rows(const svm_problem *prob, int d, int transpose) {
+	double *A = (double*) calloc((size_t)prob->l * d, sizeof(double));
+	for (int i=0; i<prob->l; i++) {
+		for (const svm_node *x = prob->x[i]; x->index > 0; x++) {
+			if (x->index <= d) {
+				size_t k = (size_t)(x->index - 1);
+				A[transpose ? k * prob->l + i : i * (size_t)d + k] = x->value;
+			}
+		}
+	}
+	return A;
+}
+
+// G (na x nb) = A (na x d) times BT (d x nb).  The inner loop runs along a row
+// of BT and of G, so it vectorizes without reordering any sum (each dot
+// product still adds its terms in feature order), and the features are
+// blocked so that the rows of BT in use stay in cache.
+static void gram_product(const double *A, int na, const double *BT, int nb, int d, double *G) {
+	const int BLOCK = 256;
+	memset(G, 0, sizeof(double) * (size_t)na * nb);
+	for (int k0=0; k0<d; k0+=BLOCK) {
+		int k1 = k0+BLOCK < d ? k0+BLOCK : d;
+		for (int a=0; a<na; a++) {
+			double *g = G + (size_t)a * nb;
+			const double *row = A + (size_t)a * d;
+			for (int k=k0; k<k1; k++) {
+				const double x = row[k];
+				if (x == 0) { continue; }
+				const double *b = BT + (size_t)k * nb;
+				for (int j=0; j<nb; j++) {
+					g[j] += x * b[j];
+				}
+			}
+		}
+	}
+}
+
+// squared norm of each of the l rows of A (l x d), in feature order
+static double* squared_norms(const double *A, int l, int d) {
+	double *sq = Malloc(double, l);
+	for (int i=0; i<l; i++) {
+		double sum = 0;
+		for (int k=0; k<d; k++) { sum += A[(size_t)i * d + k] * A[(size_t)i * d + k]; }
+		sq[i] = sum;
+	}
+	return sq;
+}
+
+// dot products of the rows of prob with the n rows of X (XT, d x n) and
+// the squared norm of each row of prob
+static void gram_rows(const svm_problem *prob, const double *XT, int n, int d, double **G, double **sq) {
+	double *A = dense_rows(prob, d, 0);
+	*G = Malloc(double, (size_t)prob->l * n);
+	gram_product(A, prob->l, XT, n, d, *G);
+	*sq = squared_norms(A, prob->l, d);
+	free(A);
+}
+
+frac_gram* frac_gram_alloc(const svm_problem *prob_X, const svm_problem *prob_V, const svm_problem *prob_Q, int d) {
+
+	frac_gram *gram = Malloc(frac_gram, 1);
+	gram->n = prob_X->l;
+	gram->v = prob_V ? prob_V->l : 0;
+	gram->q = prob_Q->l;
+	gram->VX = gram->V_sq = NULL;
+
+	double *XT = dense_rows(prob_X, d, 1);
+	gram_rows(prob_X, XT, gram->n, d, &gram->XX, &gram->X_sq);
+	gram_rows(prob_Q, XT, gram->n, d, &gram->QX, &gram->Q_sq);
+	if (prob_V) { gram_rows(prob_V, XT, gram->n, d, &gram->VX, &gram->V_sq); }
+	free(XT);
+
+	return gram;
+}
+
+void frac_gram_free(frac_gram *gram) {
+	if (!gram) { return; }
+	free(gram->XX); free(gram->VX); free(gram->QX);
+	free(gram->X_sq); free(gram->V_sq); free(gram->Q_sq);
+	free(gram);
+}
+
+// a kernel value from the dot product and squared norms of two instances
+static double gram_kernel(const svm_parameter *param, double dot, double sq_a, double sq_b) {
+	switch (param->kernel_type) {
+		case LINEAR: return dot;
+		case POLY: return pow(param->gamma*dot + param->coef0, param->degree);
+		case RBF: return exp(-param->gamma*(sq_a + sq_b - 2*dot));
+		case SIGMOID: return tanh(param->gamma*dot + param->coef0);
+		default: return 0;
+	}
+}
+
+// A PRECOMPUTED problem of l instances against the n training instances,
+// without feature i: G (l x n) and sq are the instances' dot products and
+// squared norms over all features, f and f_X the feature's values.  Row r is
+// {0, r+1}, then K(r, training instance b) at node b+1, then -1 (LIBSVM's
+// precomputed layout, so subsets of a training problem keep their kernel).
+// y becomes the problem's y.
+static svm_problem kernel_problem(int l, const double *G, const double *sq, const double *f,
+	int n, const double *sq_X, const double *f_X, const svm_parameter *param, double *y) {
+
+	svm_problem P;
+	P.l = l;
+	P.y = y;
+	P.x = Malloc(svm_node*, l);
+	svm_node *nodes = Malloc(svm_node, (size_t)l * (n+2));
+	for (int r=0; r<l; r++) {
+		svm_node *row = nodes + (size_t)r * (n+2);
+		double sq_r = sq[r] - f[r]*f[r];
+		row[0].index = 0;
+		row[0].value = r+1;
+		for (int b=0; b<n; b++) {
+			double dot = G[(size_t)r * n + b] - f[r]*f_X[b];
+			row[b+1].index = b+1;
+			row[b+1].value = gram_kernel(param, dot, sq_r, sq_X[b] - f_X[b]*f_X[b]);
+		}
+		row[n+1].index = -1;
+		row[n+1].value = 0;
+		P.x[r] = row;
+	}
+	return P;
+}
+
+static void free_kernel_problem(svm_problem *P) {
+	if (P->l > 0) { free(P->x[0]); }
+	free(P->x);
+	free(P->y);
+}
+
+void frac_feature_gram(const frac_gram *gram, const svm_problem *shared_X, const svm_problem *shared_V,
+	const svm_problem *shared_Q, int i, const svm_parameter *shared_param, double *ns) {
+
+	// the solver only looks the kernel up; it is derived with the caller's kernel type
+	svm_parameter param = *shared_param;
+	param.kernel_type = PRECOMPUTED;
+	param.mask_feature = 0;
+
+	const int n = gram->n;
+	double *f_X = Malloc(double, n);
+	target_values(shared_X, i, f_X);
+	double *y_X = Malloc(double, n);
+	memcpy(y_X, f_X, sizeof(double) * n);
+	svm_problem X = kernel_problem(n, gram->XX, gram->X_sq, f_X, n, gram->X_sq, f_X, shared_param, y_X), V;
+	svm_problem *prob_V = NULL;
+	if (shared_V) {
+		double *y_V = Malloc(double, gram->v);
+		target_values(shared_V, i, y_V);
+		V = kernel_problem(gram->v, gram->VX, gram->V_sq, y_V, n, gram->X_sq, f_X, shared_param, y_V);
+		prob_V = &V;
+	}
+
+	frac_model fm;
+	train_targets(&X, prob_V, i, &param, &fm);
+	if (prob_V) { free_kernel_problem(&V); }
+
+	double *y_Q = Malloc(double, gram->q);
+	target_values(shared_Q, i, y_Q);
+	svm_problem Q = kernel_problem(gram->q, gram->QX, gram->Q_sq, y_Q, n, gram->X_sq, f_X, shared_param, y_Q);
+	score_targets(&fm, &Q, ns);
+	free_kernel_problem(&Q);
+
+	frac_free_model(&fm); // its SVs are rows of X
+	free_kernel_problem(&X);
+	free(f_X);
+
+}
+
+// Householder reduction of the symmetric n x n matrix V to tridiagonal form:
+// d gets the diagonal, e the subdiagonal (e[0] unused) and V the transpose of
+// the orthogonal transformation.  From the public-domain JAMA (EISPACK
+// tred2), with V transposed so that its inner loops run along rows.
+static void tridiagonalize(int n, double *V, double *d, double *e) {
+
+	for (int j=0; j<n; j++) { d[j] = V[(size_t)j*n + n-1]; }
+
+	for (int i=n-1; i>0; i--) {
+
+		double scale = 0, h = 0;
+		for (int k=0; k<i; k++) { scale += fabs(d[k]); }
+
+		if (scale == 0) {
+			e[i] = d[i-1];
+			for (int j=0; j<i; j++) {
+				d[j] = V[(size_t)j*n + i-1];
+				V[(size_t)j*n + i] = 0;
+				V[(size_t)i*n + j] = 0;
+			}
+		} else {
+			for (int k=0; k<i; k++) { d[k] /= scale; h += d[k]*d[k]; }
+			double f = d[i-1];
+			double g = f > 0 ? -sqrt(h) : sqrt(h);
+			e[i] = scale*g;
+			h -= f*g;
+			d[i-1] = f-g;
+			for (int j=0; j<i; j++) { e[j] = 0; }
+
+			for (int j=0; j<i; j++) {
+				f = d[j];
+				V[(size_t)i*n + j] = f;
+				g = e[j] + V[(size_t)j*n + j]*f;
+				for (int k=j+1; k<=i-1; k++) {
+					g += V[(size_t)j*n + k]*d[k];
+					e[k] += V[(size_t)j*n + k]*f;
+				}
+				e[j] = g;
+			}
+			f = 0;
+			for (int j=0; j<i; j++) { e[j] /= h; f += e[j]*d[j]; }
+			double hh = f/(h+h);
+			for (int j=0; j<i; j++) { e[j] -= hh*d[j]; }
+			for (int j=0; j<i; j++) {
+				f = d[j];
+				g = e[j];
+				for (int k=j; k<=i-1; k++) { V[(size_t)j*n + k] -= f*e[k] + g*d[k]; }
+				d[j] = V[(size_t)j*n + i-1];
+				V[(size_t)j*n + i] = 0;
+			}
+		}
+		d[i] = h;
+	}
+
+	// accumulate the transformations
+	for (int i=0; i<n-1; i++) {
+		V[(size_t)i*n + n-1] = V[(size_t)i*n + i];
+		V[(size_t)i*n + i] = 1;
+		double h = d[i+1];
+		if (h != 0) {
+			for (int k=0; k<=i; k++) { d[k] = V[(size_t)(i+1)*n + k]/h; }
+			for (int j=0; j<=i; j++) {
+				double g = 0;
+				for (int k=0; k<=i; k++) { g += V[(size_t)(i+1)*n + k]*V[(size_t)j*n + k]; }
+				for (int k=0; k<=i; k++) { V[(size_t)j*n + k] -= g*d[k]; }
+			}
+		}
+		for (int k=0; k<=i; k++) { V[(size_t)(i+1)*n + k] = 0; }
+	}
+	for (int j=0; j<n; j++) {
+		d[j] = V[(size_t)j*n + n-1];
+		V[(size_t)j*n + n-1] = 0;
+	}
+	V[(size_t)(n-1)*n + n-1] = 1;
+	e[0] = 0;
+}
+
+// Eigenvalues (d) and eigenvectors of a tridiagonal matrix by the implicit
+// QL method.  VT is the transformation as tridiagonalize leaves it, and gets
+// the eigenvectors as its rows.  From JAMA (EISPACK tql2), transposed.
+static void tridiagonal_ql(int n, double *VT, double *d, double *e) {
+
+	for (int i=1; i<n; i++) { e[i-1] = e[i]; }
+	e[n-1] = 0;
+
+	double f = 0, tst1 = 0;
+	const double eps = pow(2.0, -52.0);
+	for (int l=0; l<n; l++) {
+
+		// find a small subdiagonal element
+		tst1 = fmax(tst1, fabs(d[l]) + fabs(e[l]));
+		int m = l;
+		while (m < n-1 && fabs(e[m]) > eps*tst1) { m++; }
+
+		// if m == l, d[l] is already an eigenvalue; otherwise iterate
+		if (m > l) {
+			do {
+				double g = d[l];
+				double p = (d[l+1] - g) / (2*e[l]);
+				double r = hypot(p, 1.0);
+				if (p < 0) { r = -r; }
+				d[l] = e[l] / (p+r);
+				d[l+1] = e[l] * (p+r);
+				double dl1 = d[l+1];
+				double h = g - d[l];
+				for (int i=l+2; i<n; i++) { d[i] -= h; }
+				f += h;
+
+				p = d[m];
+				double c = 1, c2 = 1, c3 = 1, el1 = e[l+1], s = 0, s2 = 0;
+				for (int i=m-1; i>=l; i--) {
+					c3 = c2;
+					c2 = c;
+					s2 = s;
+					g = c*e[i];
+					h = c*p;
+					r = hypot(p, e[i]);
+					e[i+1] = s*r;
+					s = e[i]/r;
+					c = p/r;
+					p = c*d[i] - s*g;
+					d[i+1] = h + s*(c*g + s*d[i]);
+					double *v0 = VT + (size_t)i*n, *v1 = v0 + n;
+					for (int k=0; k<n; k++) {
+						h = v1[k];
+						v1[k] = s*v0[k] + c*h;
+						v0[k] = c*v0[k] - s*h;
+					}
+				}
+				p = -s*s2*c3*el1*e[l]/dl1;
+				e[l] = s*p;
+				d[l] = c*p;
+			} while (fabs(e[l]) > eps*tst1);
+		}
+		d[l] += f;
+		e[l] = 0;
+	}
+}
+
+struct frac_ridge {
+	const frac_gram *gram;
+	double lambda;
+	double *A_inv;		// (Kc + lambda I)^-1, n x n, Kc the centered linear kernel over all features
+	double *mean_X;		// mean dot product of each training instance with the training set
+	double mean_XX;		// mean of mean_X
+};
+
+frac_ridge* frac_ridge_alloc(const frac_gram *gram, const svm_parameter *svm_param) {
+
+	const int n = gram->n;
+	frac_ridge *ridge = Malloc(frac_ridge, 1);
+	ridge->gram = gram;
+	ridge->lambda = 1 / svm_param->C;
+	ridge->mean_X = Malloc(double, n);
+	ridge->mean_XX = 0;
+	for (int a=0; a<n; a++) {
+		double sum = 0;
+		for (int b=0; b<n; b++) { sum += gram->XX[(size_t)a*n + b]; }
+		ridge->mean_X[a] = sum / n;
+		ridge->mean_XX += ridge->mean_X[a] / n;
+	}
+
+	// Kc = U' diag(w) U, so (Kc + lambda I)^-1 = U' diag(1/(w + lambda)) U
+	double *U = Malloc(double, (size_t)n*n);
+	for (int a=0; a<n; a++) {
+		for (int b=0; b<n; b++) {
+			U[(size_t)a*n + b] = gram->XX[(size_t)a*n + b] - ridge->mean_X[a] - ridge->mean_X[b] + ridge->mean_XX;
+		}
+	}
+	double *w = Malloc(double, n);
+	double *e = Malloc(double, n);
+	tridiagonalize(n, U, w, e);
+	tridiagonal_ql(n, U, w, e); // eigenvectors are the rows of U
+
+	// sum of the rank-one terms of the eigenvectors
+	ridge->A_inv = (double*) calloc((size_t)n*n, sizeof(double));
+	for (int j=0; j<n; j++) {
+		const double *u = U + (size_t)j*n;
+		const double scale = 1 / ((w[j] > 0 ? w[j] : 0) + ridge->lambda); // Kc is positive semidefinite up to rounding
+		for (int a=0; a<n; a++) {
+			const double x = scale * u[a];
+			double *A_a = ridge->A_inv + (size_t)a*n;
+			for (int b=0; b<n; b++) { A_a[b] += x * u[b]; }
+		}
+	}
+	free(U); free(w); free(e);
+
+	return ridge;
+}
+
+void frac_ridge_free(frac_ridge *ridge) {
+	if (!ridge) { return; }
+	free(ridge->A_inv);
+	free(ridge->mean_X);
+	free(ridge);
+}
+
+// ridge predictions of l instances with dot products G (l x n) with the
+// training instances and feature values f: y_mean + sum_b a_b Kc_i(r, b),
+// Kc_i the centered kernel without feature i
+static void ridge_predict(const frac_ridge *ridge, const double *a, double y_mean, double fa,
+	int l, const double *G, const double *f, double *g) {
+
+	const int n = ridge->gram->n;
+	double sum_a = 0, a_mean = 0;
+	for (int b=0; b<n; b++) { sum_a += a[b]; a_mean += a[b] * ridge->mean_X[b]; }
+	for (int r=0; r<l; r++) {
+		const double *G_r = G + (size_t)r*n;
+		double dot = 0, mean_r = 0;
+		for (int b=0; b<n; b++) { dot += a[b] * G_r[b]; mean_r += G_r[b]; }
+		mean_r /= n;
+		g[r] = y_mean + dot - a_mean + (ridge->mean_XX - mean_r) * sum_a - (f[r] - y_mean) * fa;
+	}
+}
+
+void frac_feature_ridge(const frac_ridge *ridge, const svm_problem *shared_X, const svm_problem *shared_V,
+	const svm_problem *shared_Q, int i, double *ns) {
+
+	const frac_gram *gram = ridge->gram;
+	const int n = gram->n;
+	const double lambda = ridge->lambda;
+
+	// centered targets
+	double *y_X = Malloc(double, n);
+	target_values(shared_X, i, y_X);
+	double y_mean = 0;
+	for (int b=0; b<n; b++) { y_mean += y_X[b] / n; }
+	double *y_c = Malloc(double, n);
+	for (int b=0; b<n; b++) { y_c[b] = y_X[b] - y_mean; }
+
+	// Without feature i the centered kernel is Kc - y_c y_c', so by
+	// Sherman-Morrison M = (Kc - y_c y_c' + lambda I)^-1 = A_inv + u u' / (1 - s)
+	// with u = A_inv y_c and s = y_c' u, and the dual coefficients are
+	// a = M y_c = u / (1 - s)
+	double *u = Malloc(double, n);
+	double s = 0;
+	for (int a=0; a<n; a++) {
+		const double *A_a = ridge->A_inv + (size_t)a*n;
+		double sum = 0;
+		for (int b=0; b<n; b++) { sum += A_a[b] * y_c[b]; }
+		u[a] = sum;
+		s += y_c[a] * sum;
+	}
+	double *coef = Malloc(double, n);
+	double fa = 0; // y_c' a, the feature's own term of the kernel
+	for (int b=0; b<n; b++) { coef[b] = u[b] / (1-s); fa += y_c[b] * coef[b]; }
+
+	frac_model fm;
+	fm.svm = NULL;
+	if (shared_V) {
+
+		double *y_V = Malloc(double, gram->v);
+		double *g_V = Malloc(double, gram->v);
+		target_values(shared_V, i, y_V);
+		ridge_predict(ridge, coef, y_mean, fa, gram->v, gram->VX, y_V, g_V);
+		fit_error_model(&fm, i, y_V, g_V, gram->v);
+		free(y_V); free(g_V);
+
+	} else {
+
+		// Exact leave-one-out predictions from the hat matrix H = J + Kc_i M
+		// (J = 11'/n, from the unpenalized intercept): the residual is
+		// lambda a, and 1 - H_bb = lambda M_bb - 1/n
+		double *g_X = Malloc(double, n);
+		for (int b=0; b<n; b++) {
+			double M_bb = ridge->A_inv[(size_t)b*n + b] + u[b]*u[b] / (1-s);
+			g_X[b] = y_X[b] - lambda * coef[b] / (lambda * M_bb - 1.0 / n);
+		}
+		fit_error_model(&fm, i, y_X, g_X, n);
+		free(g_X);
+
+	}
+
+	double *y_Q = Malloc(double, gram->q);
+	double *g_Q = Malloc(double, gram->q);
+	target_values(shared_Q, i, y_Q);
+	ridge_predict(ridge, coef, y_mean, fa, gram->q, gram->QX, y_Q, g_Q);
+	surprisal(&fm, y_Q, g_Q, gram->q, ns);
+
+	free(y_Q); free(g_Q);
+	free(y_X); free(y_c); free(u); free(coef);
+
+}
+
+void frac_run(const svm_problem *prob_X, const svm_problem *prob_V, const svm_problem *prob_Q,
+	int f1, int fD, const svm_parameter *svm_param, double *ns) {
+
+	frac_gram *gram = NULL;
+	frac_ridge *ridge = NULL;
+	if (svm_param->gram || svm_param->ridge) {
+		int d = count_features(prob_Q, count_features(prob_X, prob_V ? count_features(prob_V, 0) : 0));
+		gram = frac_gram_alloc(prob_X, prob_V, prob_Q, d);
+	}
+	if (svm_param->ridge) { ridge = frac_ridge_alloc(gram, svm_param); }
+	for (int i = f1; i <= fD; i++) {
+		double *row = ns + (size_t)(i-f1) * prob_Q->l;
+		if (ridge) {
+			frac_feature_ridge(ridge, prob_X, prob_V, prob_Q, i, row);
+		} else if (gram) {
+			frac_feature_gram(gram, prob_X, prob_V, prob_Q, i, svm_param, row);
+		} else {
+			frac_feature(prob_X, prob_V, prob_Q, i, svm_param, row);
+		}
+	}
+	frac_ridge_free(ridge);
+	frac_gram_free(gram);
+
+}
+
+svm_problem* frac_view(const svm_problem *prob, const int *bag, int l) {
+	svm_problem *view = Malloc(svm_problem, 1);
+	view->l = l;
+	view->y = Malloc(double, l);
+	view->x = Malloc(svm_node*, l);
+	for (int i=0; i<l; i++) {
+		view->x[i] = prob->x[bag[i]];
+		view->y[i] = prob->y[bag[i]];
+	}
+	return view;
+}
+
+void frac_free_view(svm_problem *view) {
+	if (!view) { return; }
+	free(view->x);
+	free(view->y);
+	free(view);
+}
+
+// Model file records, per model:
+//	int feature, svm_type, kernel_type, degree, mask_feature, l
+//	double gamma, coef0, rho, mu, sigma, entropy
+//	int row[l]		row of the training problem of each SV
+//	double sv_coef[l]
+#define FRAC_MODEL_MAGIC "FRACMOD1"
+
+int frac_save_models(FILE *fp, const frac_model *models, int n, const svm_problem *X) {
+
+	if (fwrite(FRAC_MODEL_MAGIC, 1, 8, fp) != 8 || fwrite(&n, sizeof(int), 1, fp) != 1) { return -1; }
+
+	for (int m=0; m<n; m++) {
+		const frac_model *fm = &models[m];
+		const svm_model *model = fm->svm;
+		if (model->nr_class != 2 || model->param.svm_type < ONE_CLASS) { return -1; } // one decision function only
+		int ints[6] = { fm->feature, model->param.svm_type, model->param.kernel_type,
+			model->param.degree, model->param.mask_feature, model->l };
+		double doubles[6] = { model->param.gamma, model->param.coef0, model->rho[0],
+			fm->error.mu, fm->error.sigma, fm->entropy };
+
+		// SVs of a trained model are rows of its training problem, in row
+		// order, so each search goes on from the previous SV's row
+		int *rows = Malloc(int, model->l);
+		int i = 0;
+		for (int k=0; k<model->l; k++) {
+			while (i < X->l && X->x[i] != model->SV[k]) { i++; }
+			if (i == X->l) { free(rows); return -1; }
+			rows[k] = i++;
+		}
+
+		int ok = fwrite(ints, sizeof(int), 6, fp) == 6 &&
+			fwrite(doubles, sizeof(double), 6, fp) == 6 &&
+			fwrite(rows, sizeof(int), model->l, fp) == (size_t)model->l &&
+			fwrite(model->sv_coef[0], sizeof(double), model->l, fp) == (size_t)model->l;
+		free(rows);
+		if (!ok) { return -1; }
+	}
+
+	return 0;
+}
+
+int frac_load_models(FILE *fp, frac_model *models, int n, const svm_problem *X) {
+
+	char magic[8];
+	int count;
+	if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, FRAC_MODEL_MAGIC, 8) != 0 ||
+		fread(&count, sizeof(int), 1, fp) != 1 || count != n) { return -1; }
+
+	for (int m=0; m<n; m++) {
+		int ints[6];
+		double doubles[6];
+		if (fread(ints, sizeof(int), 6, fp) != 6 || fread(doubles, sizeof(double), 6, fp) != 6 ||
+			ints[5] < 0 || ints[5] > X->l) {
+			for (int k=0; k<m; k++) { frac_free_model(&models[k]); }
+			return -1;
+		}
+
+		int l = ints[5];
+		svm_model *model = Malloc(svm_model, 1);
+		frac_default_parameter(&model->param);
+		model->param.svm_type = ints[1];
+		model->param.kernel_type = ints[2];
+		model->param.degree = ints[3];
+		model->param.mask_feature = ints[4];
+		model->param.gamma = doubles[0];
+		model->param.coef0 = doubles[1];
+		model->nr_class = 2;
+		model->l = l;
+		model->SV = Malloc(svm_node*, l);
+		model->sv_coef = Malloc(double*, 1);
+		model->sv_coef[0] = Malloc(double, l);
+		model->rho = Malloc(double, 1);
+		model->rho[0] = doubles[2];
+		model->probA = model->probB = NULL;
+		model->label = model->nSV = NULL;
+		model->free_sv = 0; // SVs are rows of X
+		model->w = NULL;
+		model->w_len = 0;
+
+		int *rows = Malloc(int, l);
+		int ok = fread(rows, sizeof(int), l, fp) == (size_t)l &&
+			fread(model->sv_coef[0], sizeof(double), l, fp) == (size_t)l;
+		for (int k=0; ok && k<l; k++) {
+			ok = rows[k] >= 0 && rows[k] < X->l;
+			if (ok) { model->SV[k] = X->x[rows[k]]; }
+		}
+		free(rows);
+
+		models[m].feature = ints[0];
+		models[m].svm = model;
+		models[m].error.mu = doubles[3];
+		models[m].error.sigma = doubles[4];
+		models[m].entropy = doubles[5];
+		if (!ok) {
+			for (int k=0; k<=m; k++) { frac_free_model(&models[k]); }
+			return -1;
+		}
+	}
+
+	return 0;
+}
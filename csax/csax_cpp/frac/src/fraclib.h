@@ -0,0 +1,109 @@
+#ifndef FRACLIB_H
+#define FRACLIB_H
+
+/*
+	FRaC library
+
+	The feature-model loop of mad.frac (see main.cpp), packaged so that
+	callers (e.g. CSAX) can run FRaC on in-memory data without writing
+	files or starting another process.  Build with "make libfrac.a".
+*/
+
+#include <stdio.h>
+
+#include "svm.h"
+#include "frac.h"
+
+// set the mad.frac default parameters (epsilon-SVR, linear kernel, C=1, p=0, leave-one-out)
+void frac_default_parameter(svm_parameter *param);
+
+// allocate a dense problem of l instances and d features.  Indices are set,
+// values (and y) are zero; the caller fills prob->x[i][j].value
+svm_problem* frac_alloc_problem(int l, int d);
+void frac_free_problem(svm_problem *prob); // only for problems from frac_alloc_problem
+
+int count_features(const svm_problem *prob, const int lower_bound); // count features in a problem
+void target_values( const svm_problem *prob, int feature, double *y ); // copy a feature's value in each instance to y
+double* predict_set( const svm_model *model, const svm_problem *prob ); // make predictions given a model and svm_problem
+double* cross_validation(const svm_problem *prob_X, const svm_parameter *svm_param); // do cross validation over training svm_prob to get predictions
+
+// The model of one (1-origin) feature: its SVR, the Gaussian model of the
+// SVR's errors and the entropy of the feature.  The SVR's support vectors
+// are rows of the training problem, which has to outlive the model.
+struct frac_model {
+	int feature;
+	svm_model *svm;
+	error_model error;
+	double entropy;
+};
+
+// Train the model of a feature on prob_X, with its error model from prob_V
+// (or cross-validation over prob_X if prob_V is NULL); see frac_feature
+void frac_train(const svm_problem *prob_X, const svm_problem *prob_V,
+	int feature, const svm_parameter *svm_param, frac_model *model);
+// Normalized surprisal of each of the prob_Q->l test instances under a model
+void frac_score(const frac_model *model, const svm_problem *prob_Q, double *ns);
+void frac_free_model(frac_model *model);
+
+// Save n models trained on X to / load them from an open binary file.  The
+// support vectors are stored as row numbers of X, so the file holds no sample
+// data and the same X (same rows, same order) must be given to load.  Only
+// one-decision-function models (SVR, one-class) can be saved.  0 on success,
+// -1 on error (nothing is left allocated by a failed load).
+int frac_save_models(FILE *fp, const frac_model *models, int n, const svm_problem *X);
+int frac_load_models(FILE *fp, frac_model *models, int n, const svm_problem *X);
+
+// Train the model for one (1-origin) feature on prob_X, build its error model
+// from prob_V (or cross-validation over prob_X if prob_V is NULL), and write
+// the normalized surprisal of each of the prob_Q->l test instances to ns.
+// The problems are only read: the feature's values become the targets of
+// private copies of y, and the kernel masks the feature (mask_feature), so
+// one set of problems can be shared by any number of feature models.  The
+// y of the problems is ignored.  Same as frac_train, frac_score and
+// frac_free_model.
+void frac_feature(const svm_problem *prob_X, const svm_problem *prob_V, const svm_problem *prob_Q,
+	int feature, const svm_parameter *svm_param, double *ns);
+
+// Run frac_feature (frac_feature_gram if svm_param->gram, frac_feature_ridge
+// if svm_param->ridge) for features
+// f1..fD (1-origin, inclusive).  ns is (fD-f1+1) x prob_Q->l, row-major (rows
+// are features, columns are test instances, as in mad.frac's output table).
+void frac_run(const svm_problem *prob_X, const svm_problem *prob_V, const svm_problem *prob_Q,
+	int f1, int fD, const svm_parameter *svm_param, double *ns);
+
+// Dot products of every training instance with every training, validation
+// and test instance over all d features, computed once.  A feature model's
+// kernel is a function of these without the feature's own term (x_ai*x_bi),
+// so with them each feature costs O(n^2) kernel work instead of O(n^2 d);
+// the solver gets the derived kernel as a PRECOMPUTED one.
+struct frac_gram;
+frac_gram* frac_gram_alloc(const svm_problem *prob_X, const svm_problem *prob_V, const svm_problem *prob_Q, int d);
+void frac_gram_free(frac_gram *gram);
+
+// Same as frac_feature, with the kernel derived from gram, which has to be
+// of the same problems.  Any kernel type but PRECOMPUTED; results equal
+// frac_feature's up to rounding.
+void frac_feature_gram(const frac_gram *gram, const svm_problem *prob_X, const svm_problem *prob_V,
+	const svm_problem *prob_Q, int feature, const svm_parameter *svm_param, double *ns);
+
+// Ridge regression feature models (linear kernel, unpenalized intercept,
+// penalty 1/C) in place of SVRs.  The centered kernel over all features is
+// eigendecomposed once, O(n^3); a feature's kernel is that kernel less a
+// rank-one term, so its model and exact leave-one-out residuals (by the
+// hat-matrix identity) cost O(n^2) and no refitting.  With a validation set,
+// its predictions give the error model instead.
+struct frac_ridge;
+frac_ridge* frac_ridge_alloc(const frac_gram *gram, const svm_parameter *svm_param);
+void frac_ridge_free(frac_ridge *ridge);
+
+// Same as frac_feature with a ridge model; ridge has to be of gram of the
+// same problems
+void frac_feature_ridge(const frac_ridge *ridge, const svm_problem *prob_X, const svm_problem *prob_V,
+	const svm_problem *prob_Q, int feature, double *ns);
+
+// A problem made of the rows bag[0..l-1] of prob (shared, not copied) and its
+// own y; free with frac_free_view
+svm_problem* frac_view(const svm_problem *prob, const int *bag, int l);
+void frac_free_view(svm_problem *view);
+
+#endif
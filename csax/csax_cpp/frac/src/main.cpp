@@ -28,8 +28,15 @@ const char VERSION[] = "mad.frac";
 #include <math.h> // noto (log)
 #include <sys/stat.h> // noto (file_exists)
 
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "frac.h"
 #include "svm.h"
+#include "fraclib.h"
 
 #define Malloc(type,n) (type *)malloc((n)*sizeof(type))
 
@@ -41,17 +48,13 @@ void parse_command_line(int argc, char **argv); //noto// char *input_file_name,
 svm_problem* read_problem(const char *filename);
 
 void dump_svm_problem(FILE *out, const svm_problem *p, const char *desc);
-int count_features(const svm_problem *prob, const int lower_bound); // noto, count features in a problem
-void target_swap( svm_problem *prob, int feature ); // noto, replace svm_problem's target value with the feature's
-void target_replace( svm_problem *prob, int feature ); // noto, reverse of above
 const char* now(); // current time as string
-double* predict_set( const svm_model *model, const svm_problem *prob ); // noto, make predictions given a model and svm_problem.  
-double* cross_validation(const svm_problem *prob_X, const svm_parameter *svm_param); // noto, do cross validation over training svm_prob to get predictions
 int file_exists(const char *filename); // noto, Boolean 
 
 struct svm_parameter svm_param;		// set by parse_command_line, noto changed 'param' to 'svm_param' (noto, some parameters are for FRaC)
 
 const char *PROGRAM; // noto, name of program
+int num_jobs = 1; // features trained at once (-j)
 
 int main(int argc, char **argv) {
 		
@@ -98,93 +101,84 @@ int main(int argc, char **argv) {
 	// noto, for each (1-origin) feature 
 	const unsigned int f1 = svm_param.f1;
 	const unsigned int fD = svm_param.fD ? svm_param.fD : num_features;
-	for (unsigned int i = f1; i <= fD; i++) {
-
-		// noto, update progress to screen
-		fprintf(stderr, "# %s, Feature %d of %d\n", now(), i, num_features);
-		
-		// noto, swap feature values with target
-		for (int p=0; p<3; p++) { if (*(problems[p])) { target_swap( *(problems[p]), i); } }
-
-		// noto, train model
-		svm_model *model = svm_train(prob_X, &svm_param);  
-
-		// noto, option to save/load svm_model to/from file
-		//	if(svm_save_model(model_file_name, model)) { ...error ... }
-		//	if((model=svm_load_model(model_file_name))==0) { ...error... }
-
-		// noto, make predictions on validation set
-		int cnt_v; // number of observations/predictions (depends on if if the validation set is given separately)
-		const double *y_v; // cnt_v observations (initialized below)
-		double *g_v; // cnt_v predictions (initialized below)
-
-		if (prob_V) { 
-
-			// Validation set was given explicitly, so we simply use the model
-			// to make predictions
-			cnt_v = prob_V -> l; 
-			y_v = prob_V->y;
-			g_v  = predict_set(model, prob_V); 
 
-		} else { 
-			
-			// otherwise, use cross-validation to create a validation set from
-			// training set examples and make predictions
-			cnt_v = prob_X->l; 
-			y_v = prob_X->y;
-			g_v = cross_validation( prob_X, &svm_param );
-			
-		}
-
-		// compute cnt_v errors from cnt_v predictions
-		double *errors = Malloc(double, cnt_v); 
-		for (int v=0; v<cnt_v; v++) { 
-			errors[v] = g_v[v] - y_v[v];
-		}
-		free(g_v);
-		
-		// noto, model feature distribution (do this after predictions, since cross_validation may have set up validation sets)
-		double entropy_i = entropy(y_v, cnt_v); // the entropy of feature i
-				
-		// noto, model the predictive error
-		error_model E_i = model_error(errors, cnt_v); 
-		// const double entropy_E_i = entropy( E_i );
-		// double info_gain = entropy_i-entropy_E_i; // may be useful to report
-
-		// noto, make predictions on test set
-		double *g_t = predict_set( model, prob_Q );
-
-		// noto, add normalized surprisal to each (0-origin) test instance index q
-		for (int q=0; q<prob_Q->l; q++) {  
-
-			double y = prob_Q->y[q];
-			double g = g_t[q];
-			double p = likelihood( g-y, E_i ); // p(x_i = g | C_i, x\x_i)
-			double s = -lg(p);		// surprisal
-			if (p==0 || isnan(p)) { 
-				fprintf(stderr, "Warning:  probability of test instance #%d underflowed.\n", q+1);
-				s = MAX_SURPRISAL; // don't let surprisal <- inf because of underflow (prob. density of Gaussian can't truly be zero)
-			}
-			double ns = s - entropy_i; // normalized surprisal
-			if (ns > MAX_NORMALIZED_SURPRISAL) { 
-				fprintf(stderr, "Warning:  normalized surprisal of test instance #%d overflowed.\n", q+1);
-				ns = MAX_NORMALIZED_SURPRISAL;
+	// features run on num_jobs threads: frac_feature only reads the problems
+	// (each call has its own targets and masks its feature), so they are
+	// shared.  A row is written once it and all rows before it are done, so
+	// the output is in feature order.
+	std::atomic<unsigned int> next(f1);
+	std::mutex output;
+	std::map<unsigned int, std::vector<double> > finished; // rows waiting for an earlier feature
+	unsigned int written = f1; // next feature to write
+
+	// with -G, the dot products of all features are computed once and each
+	// feature's kernel is derived from them.  -s ridge needs them for every
+	// feature too, and shares one eigendecomposition of the kernel
+	frac_gram *gram = svm_param.gram || svm_param.ridge ? frac_gram_alloc(prob_X, prob_V, prob_Q, (int)num_features) : NULL;
+	frac_ridge *ridge = svm_param.ridge ? frac_ridge_alloc(gram, &svm_param) : NULL;
+
+	// otherwise the kernels of every feature read one dense copy of X
+	svm_param.dense = gram ? NULL : svm_dense_alloc(prob_X);
+
+	auto worker = [&]() {
+		unsigned int i;
+		while ((i = next++) <= fD) {
+
+			// noto, update progress to screen
+			{
+				std::lock_guard<std::mutex> lock(output);
+				fprintf(stderr, "# %s, Feature %d of %d\n", now(), i, num_features);
 			}
 
-			fprintf(stdout, "%f%c", ns, q+1==prob_Q->l ? '\n' : '\t'); // write ns to file, if last entry in this line, write a newline
-			if (q+1==prob_Q->l) { fflush(stdout); }
-
-		}
-		fflush(stdout);
-		free(g_t);
-		svm_free_and_destroy_model(&model);
-		
-		// noto, replace target features to their original place
-		for (int p=0; p<3; p++) { if (*(problems[p])) { target_replace( *(problems[p]), i); } }
+			// train feature i and compute the normalized surprisal of each test instance (fraclib.cpp)
+			std::vector<double> ns(prob_Q->l);
+			if (ridge) {
+				frac_feature_ridge(ridge, prob_X, prob_V, prob_Q, (int)i, ns.data());
+			} else if (gram) {
+				frac_feature_gram(gram, prob_X, prob_V, prob_Q, (int)i, &svm_param, ns.data());
+			} else {
+				frac_feature(prob_X, prob_V, prob_Q, (int)i, &svm_param, ns.data());
+			}
 
-	} // noto, next feature
+			// write ns to file, one line per feature
+			std::lock_guard<std::mutex> lock(output);
+			finished[i].swap(ns);
+			while (!finished.empty() && finished.begin()->first == written) {
+				const std::vector<double> &row = finished.begin()->second;
+				for (int q=0; q<prob_Q->l; q++) {
+					fprintf(stdout, "%f%c", row[q], q+1==prob_Q->l ? '\n' : '\t');
+				}
+				finished.erase(finished.begin());
+				written++;
+			}
+			fflush(stdout);
+
+		} // noto, next feature
+	};
+
+	// one thread budget: the feature threads hold their share of it, and
+	// each one that runs out of features, this one included, hands it to
+	// the kernel columns of the features still running (svm.cpp), as do
+	// threads beyond the number of features. This thread's share is not
+	// held (the budget counts the caller), so it is released after its
+	// features and taken back once the others are done
+	svm_set_num_threads(num_jobs);
+	std::vector<std::thread> pool;
+	for (int t = 1; t < num_jobs && (unsigned int)t <= fD - f1; t++) {
+		svm_hold_threads(1);
+		pool.push_back(std::thread([&]() { worker(); svm_release_threads(1); }));
+	}
+	worker();
+	svm_release_threads(1);
+	for (size_t t = 0; t < pool.size(); t++) {
+		pool[t].join();
+	}
+	svm_hold_threads(1);
 
 	// all done!
+	frac_ridge_free(ridge);
+	frac_gram_free(gram);
+	svm_dense_free(svm_param.dense);
 	svm_destroy_param(&svm_param);
 
 	if (prob_V) { free(prob_V->y); free(prob_V->x); }
@@ -210,65 +204,6 @@ const char* now() {
 	return buf;
 }
 
-// noto, make predictions given a model and svm_problem.  
-// Return malloc'ed and populated array of predictions.
-double* predict_set( const svm_model *model, const svm_problem *prob ) { 
-
-	double *P = (double*)(malloc(sizeof(double) * prob->l));  // P is predictions
-	for (int i=0; i<prob->l; i++) { 
-		P[i] = svm_predict(model, prob->x[i]);
-	}
-	return P;
-
-}
-
-// noto, run cross-validation to make predicitions
-// return dynamically allocated array of predictions 
-//	parallel to prob_X->y
-double* cross_validation(const svm_problem *prob_X, const svm_parameter *svm_param) {
-
-	double *predictions = (double*) malloc(sizeof(double) * prob_X->l); 
-
-	svm_problem TP, TU; // train prime, tune (temporary organization storage)
-	TP.x = (svm_node**) malloc(sizeof(svm_node*) * prob_X->l); 
-	TU.x = (svm_node**) malloc(sizeof(svm_node*) * prob_X->l); 
-	TP.y = (double*) malloc(sizeof(double) * prob_X->l); 
-	TU.y = (double*) malloc(sizeof(double) * prob_X->l); 
-
-	const int folds = svm_param->folds ? svm_param->folds : prob_X->l; // if svm_param->folds is zero, use leave-one-out
-
-	for (int fold=0; fold < folds; fold++) { 
-
-		// divide x and y into stratified train/test sets.  I use a stratified strategy:
-		// put every Nth instance in tune set, starting with fold index. 
-		TP.l = TU.l = 0;
-		for (int i=0; i<prob_X->l; i++) { 
-			svm_problem *T = (i%(folds)==fold) ? &TU : &TP;
-			T->y[T->l] = prob_X->y[i]; 
-			T->x[T->l] = prob_X->x[i]; 
-			T->l = T->l + 1;
-		}
-		
-		// dump_svm_problem(stderr, &TP, "Train' set"); 
-		// dump_svm_problem(stderr, &TU, "Tune set"); 
-
-		// train and predict
-		svm_model *model = svm_train(&TP, svm_param);  
-		double *fold_predictions = predict_set(model, &TU); 
-	
-		// copy prediction back to appropriate place in output array
-		int f = 0; //  index in fold_predictions
-		for (int i=0; i<prob_X->l; i++) { 
-			if (i%(folds)==fold) { predictions[i] = fold_predictions[f++]; }
-		}
-
-	}
-
-	free(TP.x); free(TP.y); free(TU.x); free(TU.y);
-		
-	return predictions;
-}
-
 void exit_with_version() { 
 	fprintf(stderr, "%s version %s\n", PROGRAM, VERSION); 
 	exit(0);
@@ -304,12 +239,18 @@ void exit_with_help()
 	"    -T Timeout (seconds) for SVM solver optimization\n" 
 	"    -1 <integer> First feature to do (for batch jobs and unfinished processes; default 1)\n"
 	"    -D <integer> Last feature to do (default <number-of-features>)\n"
+	"    -j <integer> Number of threads: features are trained on as many at once, and threads\n"
+	"       without a feature compute kernel columns of large training sets (default 1)\n"
+	"    -G <0|1> Compute the Gram matrix of all features once and derive each feature's\n"
+	"       kernel from it (faster when there are many more features than instances; default 0)\n"
 	"  \n" 
 	"  LIBSVM options (some defaults have changed):\n"
 	"  \n"
 	"    -s svm_type : set type of SVM (default 0)\n"
 	"    	0 -- epsilon-SVR\n"
 	"    	1 -- nu-SVR\n"
+	"    	ridge -- ridge regression with exact leave-one-out errors (linear kernel only;\n"
+	"    	         penalty 1/cost; the kernel is eigendecomposed once for all features)\n"
 	"    -t kernel_type : set type of kernel function (default 0)\n"
 	"    	0 -- linear: u'*v\n"
 	"    	1 -- polynomial: (gamma*u'*v + coef0)^degree\n"
@@ -344,31 +285,8 @@ void parse_command_line(int argc, char **argv) //noto// char *input_file_name, c
 	int i;
 	void (*print_func)(const char*) = NULL;	// default printing to std. out
 
-	// default values
-	svm_param.svm_type = EPSILON_SVR; // default for frac.libsvr is EPSILON_SVR, not C_SVC
-	svm_param.kernel_type = LINEAR; // noto changed default from RBF
-	svm_param.degree = 3;
-	svm_param.gamma = 0;	// 1/num_features
-	svm_param.coef0 = 0;
-	svm_param.nu = 0.5;
-	svm_param.cache_size = 100;
-	svm_param.C = 1;
-	svm_param.eps = 1e-3;
-	svm_param.p = 0.0;	// noto changed default from 0.1
-	svm_param.shrinking = 1;
-	svm_param.probability = 0;
-	svm_param.nr_weight = 0;
-	svm_param.weight_label = NULL;
-	svm_param.weight = NULL;
-	svm_param.timeout = 86400; // noto
-
-	// noto, svm_param default values
-	svm_param.X_file = 
-	svm_param.V_file = 
-	svm_param.Q_file = NULL;
-	svm_param.folds = 0; // zero will be interpreted later as leave-one-out
-	svm_param.f1 = 1;
-	svm_param.fD = 0; // zero will later be interpreted as number-of-features
+	// default values (fraclib.cpp)
+	frac_default_parameter(&svm_param);
 
 	// parse options
 	for (i=1; i<argc; i++) {
@@ -410,11 +328,19 @@ void parse_command_line(int argc, char **argv) //noto// char *input_file_name, c
 			case 'D':
 				svm_param.fD = atoi(argv[i]);
 				break;
+			case 'G':
+				svm_param.gram = atoi(argv[i]);
+				break;
+			case 'j':
+				num_jobs = atoi(argv[i]);
+				if (num_jobs < 1) { fprintf(stderr, "\nIllegal option: -j %d\n\n", num_jobs); exit_with_help(); }
+				break;
 
 
 			// SVM options:
 
 			case 's':
+				if (!strcmp(argv[i], "ridge")) { svm_param.ridge = 1; break; }
 				svm_param.svm_type = atoi(argv[i]) + EPSILON_SVR; // EPSILON_SVR is the 0th feasible choice for this 
 				if (svm_param.svm_type != EPSILON_SVR && svm_param.svm_type != NU_SVR) { fprintf(stderr, "\nIllegal option: -s %d\n\n", atoi(argv[i])); exit_with_help(); } // noto
 				break;
@@ -465,6 +391,8 @@ void parse_command_line(int argc, char **argv) //noto// char *input_file_name, c
 	if (!svm_param.X_file) { fprintf(stderr, "Missing required argument: -X\n"); error++; }
 	if (!svm_param.Q_file) { fprintf(stderr, "Missing required argument: -Q\n"); error++; }
 	if (error) { exit_with_help(); }
+	if (svm_param.ridge && svm_param.kernel_type != LINEAR) { fprintf(stderr, "Error: -s ridge needs the linear kernel (-t 0)\n"); exit(1); }
+	if (svm_param.ridge && svm_param.folds) { fprintf(stderr, "Error: -s ridge does leave-one-out (no -N)\n"); exit(1); }
 
 	svm_set_print_string_function(print_func);
 
@@ -580,45 +508,6 @@ svm_problem* read_problem(const char *filename) {
 
 
 
-// noto, count features in a problem
-int count_features(const svm_problem *prob, const int lower_bound) {
-
-	int d = lower_bound; // return value, d = number of features
-
-	for (int i=0; i<prob->l; i++) { 
-		for (svm_node *p = prob->x[i]; p->index > 0; p++) { 
-			d = p->index > d ? p->index : d;
-		}
-	}
-
-	return d;
-}
-
-void target_swap( svm_problem *prob, int feature ) {
-	for (int i=0; i<prob->l; i++) { 
-		prob->y[i] = 0;
-		for (svm_node *x = prob->x[i]; x->index > 0; x++) { 
-			if (x->index == feature) { 
-				prob->y[i] = x->value;
-				x->value = 0;
-				break;
-			}
-		}
-	}
-}
-
-void target_replace( svm_problem *prob, int feature ) {
-	for (int i=0; i<prob->l; i++) { 
-		for (svm_node *x = prob->x[i]; x->index > 0; x++) { 
-			if (x->index == feature) { 
-				x->value = prob->y[i];
-				break;
-			}
-		}
-		prob->y[i] = 0;
-	}
-}
-
 // noto, dump svm_problem
 void dump_svm_problem(FILE *out, const svm_problem *p, const char *desc) {
 
@@ -5,8 +5,14 @@
 #include <float.h>
 #include <string.h>
 #include <stdarg.h>
-#include <sys/times.h>  // noto 
-#include <unistd.h>     // noto
+#include <time.h>       // clock_gettime (solver timeout)
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <algorithm>
+#include <thread>
 #include "svm.h"
 int libsvm_version = LIBSVM_VERSION;
 typedef float Qfloat;
@@ -34,6 +40,14 @@ static inline double powi(double base, int times)
 	}
 	return ret;
 }
+// CPU time used by the calling thread, in seconds
+static double thread_cpu_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
 #define INF HUGE_VAL
 #define TAU 1e-12
 #define Malloc(type,n) (type *)malloc((n)*sizeof(type))
@@ -79,111 +93,407 @@ public:
 	void swap_index(int i, int j);	
 private:
 	int l;
-	long int size;
-	struct head_t
-	{
-		head_t *prev, *next;	// a circular list
-		Qfloat *data;
-		int len;		// data[0,len) is cached in this entry
-	};
+	int slots;		// columns held, each in a slot of stride Qfloats
+	size_t stride;
+	Qfloat *data;		// slot s is data[s*stride, s*stride+l)
+
+	// all int arrays below and data are carved from one slab
+	int *slot;		// slot of each column, -1 if not cached
+	int *column;		// column in each slot
+	int *len;		// data[0,len) of the slot is cached
+	int *prev, *next;	// LRU list of the used slots, circular through slots
+	int *free_slot;		// stack of unused slots
+	int nr_free;
+
+	void *slab;		// the thread's slab, or one of its own
+	bool own_slab;
+
+	void lru_delete(int s);
+	void lru_insert(int s);
+	void release(int s);
+};
 
-	head_t *head;
-	head_t lru_head;
-	void lru_delete(head_t *h);
-	void lru_insert(head_t *h);
+// One slab per thread, kept for the thread's next Cache: mad.frac and CSAX
+// train a model per feature (and fold), so the allocation and its page
+// faults would otherwise come back with every svm_train.  A second Cache
+// alive in the same thread gets a slab of its own.
+struct CacheSlab
+{
+	void *mem;
+	size_t bytes;
+	bool in_use;
+	CacheSlab():mem(0),bytes(0),in_use(false) {}
+	~CacheSlab() { free(mem); }
 };
+static thread_local CacheSlab thread_slab;
 
-Cache::Cache(int l_,long int size_):l(l_),size(size_)
+static void *slab_alloc(size_t bytes)
 {
-	head = (head_t *)calloc(l,sizeof(head_t));	// initialized to 0
-	size /= sizeof(Qfloat);
-	size -= l * sizeof(head_t) / sizeof(Qfloat);
-	size = max(size, 2 * (long int) l);	// cache must be large enough for two columns
-	lru_head.next = lru_head.prev = &lru_head;
+	void *p;
+	if(posix_memalign(&p,64,bytes) != 0)
+	{
+		fprintf(stderr,"Could not allocate a kernel cache of %lu bytes\n",(unsigned long)bytes);
+		exit(1);
+	}
+	return p;
+}
+
+Cache::Cache(int l_,long int size):l(l_)
+{
+	// slots of a full column, padded to 64 bytes, as many as fit (at least
+	// two, and never more than there are columns)
+	stride = ((size_t)l + 15) & ~(size_t)15;
+	long int fit = size / (long int)(stride*sizeof(Qfloat));
+	slots = (int)min((long int)l, max(fit, 2L));
+
+	size_t ints = (size_t)l + 5*(size_t)slots + 2;
+	size_t head = (ints*sizeof(int) + 63) & ~(size_t)63;
+	size_t bytes = head + (size_t)slots*stride*sizeof(Qfloat);
+	if(!thread_slab.in_use)
+	{
+		if(thread_slab.bytes < bytes)
+		{
+			free(thread_slab.mem);
+			thread_slab.mem = slab_alloc(bytes);
+			thread_slab.bytes = bytes;
+		}
+		thread_slab.in_use = true;
+		slab = thread_slab.mem;
+		own_slab = false;
+	}
+	else
+	{
+		slab = slab_alloc(bytes);
+		own_slab = true;
+	}
+
+	int *p = (int *)slab;
+	slot = p; p += l;
+	column = p; p += slots;
+	len = p; p += slots;
+	prev = p; p += slots+1;
+	next = p; p += slots+1;
+	free_slot = p;
+	data = (Qfloat *)((char *)slab + head);
+
+	for(int i=0;i<l;i++)
+		slot[i] = -1;
+	nr_free = slots;
+	for(int s=0;s<slots;s++)
+	{
+		len[s] = 0;
+		free_slot[s] = slots-1-s;
+	}
+	prev[slots] = next[slots] = slots;
 }
 
 Cache::~Cache()
 {
-	for(head_t *h = lru_head.next; h != &lru_head; h=h->next)
-		free(h->data);
-	free(head);
+	if(own_slab)
+		free(slab);
+	else
+		thread_slab.in_use = false;
 }
 
-void Cache::lru_delete(head_t *h)
+void Cache::lru_delete(int s)
 {
 	// delete from current location
-	h->prev->next = h->next;
-	h->next->prev = h->prev;
+	next[prev[s]] = next[s];
+	prev[next[s]] = prev[s];
 }
 
-void Cache::lru_insert(head_t *h)
+void Cache::lru_insert(int s)
 {
 	// insert to last position
-	h->next = &lru_head;
-	h->prev = lru_head.prev;
-	h->prev->next = h;
-	h->next->prev = h;
+	next[s] = slots;
+	prev[s] = prev[slots];
+	next[prev[s]] = s;
+	prev[slots] = s;
 }
 
-int Cache::get_data(const int index, Qfloat **data, int len)
+// drop the column in used slot s
+void Cache::release(int s)
 {
-	head_t *h = &head[index];
-	if(h->len) lru_delete(h);
-	int more = len - h->len;
+	lru_delete(s);
+	slot[column[s]] = -1;
+	len[s] = 0;
+	free_slot[nr_free++] = s;
+}
 
-	if(more > 0)
+int Cache::get_data(const int index, Qfloat **data_, int len_)
+{
+	int s = slot[index];
+	if(s < 0)
 	{
-		// free old space
-		while(size < more)
-		{
-			head_t *old = lru_head.next;
-			lru_delete(old);
-			free(old->data);
-			size += old->len;
-			old->data = 0;
-			old->len = 0;
-		}
-
-		// allocate new space
-		h->data = (Qfloat *)realloc(h->data,sizeof(Qfloat)*len);
-		size -= more;
-		swap(h->len,len);
+		if(nr_free == 0)
+			release(next[slots]);	// least recently used
+		s = free_slot[--nr_free];
+		slot[index] = s;
+		column[s] = index;
 	}
-
-	lru_insert(h);
-	*data = h->data;
-	return len;
+	else
+		lru_delete(s);
+	lru_insert(s);
+
+	*data_ = data + (size_t)s*stride;
+	int cached = len[s];
+	if(len_ > cached)
+		len[s] = len_;
+	return cached;
 }
 
 void Cache::swap_index(int i, int j)
 {
 	if(i==j) return;
 
-	if(head[i].len) lru_delete(&head[i]);
-	if(head[j].len) lru_delete(&head[j]);
-	swap(head[i].data,head[j].data);
-	swap(head[i].len,head[j].len);
-	if(head[i].len) lru_insert(&head[i]);
-	if(head[j].len) lru_insert(&head[j]);
+	int si = slot[i], sj = slot[j];
+	slot[i] = sj;
+	slot[j] = si;
+	if(si >= 0) column[si] = j;
+	if(sj >= 0) column[sj] = i;
 
 	if(i>j) swap(i,j);
-	for(head_t *h = lru_head.next; h!=&lru_head; h=h->next)
+	for(int s = next[slots]; s != slots;)
 	{
-		if(h->len > i)
+		int after = next[s];
+		if(len[s] > i)
 		{
-			if(h->len > j)
-				swap(h->data[i],h->data[j]);
+			Qfloat *col = data + (size_t)s*stride;
+			if(len[s] > j)
+				swap(col[i],col[j]);
 			else
-			{
-				// give up
-				lru_delete(h);
-				free(h->data);
-				size += h->len;
-				h->data = 0;
-				h->len = 0;
-			}
+				release(s);	// give up
+		}
+		s = after;
+	}
+}
+
+//
+// Column pool
+//
+// Helper threads shared by every solver of the process, which compute the
+// rows of a long kernel column in blocks alongside the solver's own thread.
+// The budget (svm_set_num_threads) counts all threads, the callers'
+// included: of the n-1 helpers, those held by the application (threads of
+// its own running solvers, see svm_hold_threads) are never handed out, so
+// the process never runs more than n threads at once.  A solver that finds
+// no helper free fills its column alone.
+//
+class ColumnPool
+{
+public:
+	ColumnPool():helpers(0),free_helpers(0) {}
+
+	void set_threads(int n)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for(;helpers<n-1;helpers++)
+		{
+			std::thread(&ColumnPool::help,this).detach();
+			++free_helpers;
+		}
+	}
+	void hold(int n) { free_helpers -= n; }
+	void release(int n) { free_helpers += n; }
+
+	// f(begin,end) for blocks of [0,n) of size block, on free helpers too
+	void run(int n, int block, const std::function<void(int,int)>& f)
+	{
+		int blocks = (n+block-1)/block;
+		int k = blocks > 1 ? acquire(blocks-1) : 0;
+		if(k == 0)
+		{
+			f(0,n);
+			return;
+		}
+
+		Task task;
+		task.f = &f;
+		task.n = n;
+		task.block = block;
+		task.next = 0;
+		task.active = k;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for(int t=0;t<k;t++)
+				queue.push_back(&task);
+		}
+		wake.notify_all();
+		work(&task);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock,[&task]{ return task.active == 0; });
+		lock.unlock();
+		release(k);
+	}
+
+private:
+	struct Task
+	{
+		const std::function<void(int,int)> *f;
+		int n, block;
+		std::atomic<int> next;
+		int active;	// helpers that have yet to finish (guarded by mutex)
+	};
+
+	// up to n free helpers, none if none is free
+	int acquire(int n)
+	{
+		int k = free_helpers.load();
+		while(k > 0)
+		{
+			int take = min(k,n);
+			if(free_helpers.compare_exchange_weak(k,k-take))
+				return take;
 		}
+		return 0;
+	}
+
+	static void work(Task *task)
+	{
+		int b;
+		while((b = task->next.fetch_add(task->block)) < task->n)
+			(*task->f)(b,min(b+task->block,task->n));
 	}
+
+	void help()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while(1)
+		{
+			wake.wait(lock,[this]{ return !queue.empty(); });
+			Task *task = queue.front();
+			queue.pop_front();
+			lock.unlock();
+			work(task);
+			lock.lock();
+			if(--task->active == 0)
+				finished.notify_all();
+		}
+	}
+
+	int helpers;
+	std::atomic<int> free_helpers;
+	std::mutex mutex;
+	std::condition_variable wake, finished;
+	std::deque<Task*> queue;
+};
+
+// never destroyed: its helpers wait on it until the process exits
+static ColumnPool& column_pool()
+{
+	static ColumnPool *pool = new ColumnPool;
+	return *pool;
+}
+
+void svm_set_num_threads(int n) { column_pool().set_threads(n); }
+void svm_hold_threads(int n) { column_pool().hold(n); }
+void svm_release_threads(int n) { column_pool().release(n); }
+
+// Dot product of two dense rows of d values.  Eight partial sums, which the
+// compiler keeps in vector registers, so the SSE2, AVX2 and AVX-512 builds
+// (picked at run time where the compiler supports it) add the same terms in
+// the same order and give the same result.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(__clang__)
+__attribute__((target_clones("avx512f","avx2","default")))
+#endif
+static double dense_dot(const double *a, const double *b, int d)
+{
+	double s[8] = {0,0,0,0,0,0,0,0};
+	int k = 0;
+	for(;k+8<=d;k+=8)
+		for(int t=0;t<8;t++)
+			s[t] += a[k+t]*b[k+t];
+	double sum = ((s[0]+s[4])+(s[2]+s[6])) + ((s[1]+s[5])+(s[3]+s[7]));
+	for(;k<d;k++)
+		sum += a[k]*b[k];
+	return sum;
+}
+
+// the same without (1-origin) feature mask, if it is one of the d
+static inline double dense_dot(const double *a, const double *b, int d, int mask)
+{
+	if(mask < 1 || mask > d)
+		return dense_dot(a,b,d);
+	return dense_dot(a,b,mask-1) + dense_dot(a+mask,b+mask,d-mask);
+}
+
+// Values of a problem whose rows are all features 1..d, rows padded to a
+// multiple of 8 doubles so each starts on 64 bytes.  rows holds the problem's
+// row pointers by address, so a kernel over any subset of them (a view, a
+// fold, a feature model's problem) finds its dense rows by search.
+struct svm_dense {
+	int l;
+	int d;
+	size_t stride;
+	double *values;		// row k of the problem at values + k*stride
+	const svm_node **rows;	// sorted by address
+	int *row;		// row[t]: k of rows[t]
+};
+
+svm_dense *svm_dense_alloc(const svm_problem *prob)
+{
+	const int l = prob->l;
+	if(l == 0)
+		return NULL;
+	int n = 0;
+	while(prob->x[0][n].index == n+1)
+		++n;
+	if(prob->x[0][n].index != -1)
+		return NULL;
+	for(int i=1;i<l;i++)
+	{
+		for(int k=0;k<n;k++)
+			if(prob->x[i][k].index != k+1)
+				return NULL;
+		if(prob->x[i][n].index != -1)
+			return NULL;
+	}
+
+	size_t stride = ((size_t)n + 7) & ~(size_t)7;
+	void *p;
+	if(posix_memalign(&p,64,sizeof(double)*stride*(size_t)l) != 0)
+		return NULL;
+	svm_dense *dense = Malloc(svm_dense,1);
+	dense->l = l;
+	dense->d = n;
+	dense->stride = stride;
+	dense->values = (double *)p;
+	dense->rows = Malloc(const svm_node *,l);
+	dense->row = Malloc(int,l);
+	for(int i=0;i<l;i++)
+	{
+		double *row = dense->values + stride*(size_t)i;
+		for(int k=0;k<n;k++)
+			row[k] = prob->x[i][k].value;
+		dense->row[i] = i;
+	}
+	std::sort(dense->row,dense->row+l,[prob](int a, int b)
+		{ return std::less<const svm_node *>()(prob->x[a],prob->x[b]); });
+	for(int t=0;t<l;t++)
+		dense->rows[t] = prob->x[dense->row[t]];
+	return dense;
+}
+
+void svm_dense_free(svm_dense *dense)
+{
+	if(!dense)
+		return;
+	free(dense->values);
+	free(dense->rows);
+	free(dense->row);
+	free(dense);
+}
+
+// the dense row of x, 0 if x is not a row of the problem
+static const double *dense_row(const svm_dense *dense, const svm_node *x)
+{
+	const svm_node **end = dense->rows + dense->l;
+	const svm_node **t = std::lower_bound(dense->rows,end,x,
+		std::less<const svm_node *>());
+	if(t == end || *t != x)
+		return 0;
+	return dense->values + dense->stride*(size_t)dense->row[t-dense->rows];
 }
 
 //
@@ -213,38 +523,55 @@ public:
 	virtual void swap_index(int i, int j) const	// no so const...
 	{
 		swap(x[i],x[j]);
+		if(xd) swap(xd[i],xd[j]);
 		if(x_square) swap(x_square[i],x_square[j]);
 	}
 protected:
 
 	double (Kernel::*kernel_function)(int i, int j) const;
 
+	// data[j] = K(i,j), times y[i]*y[j] if y, for j in [start,len); long
+	// columns are shared with the column pool
+	void fill_column(int i, Qfloat *data, int start, int len,
+			 const schar *y = 0) const;
+
 private:
 	const svm_node **x;
 	double *x_square;
 
+	// With param.dense, the rows of its problem in that aligned copy; 0
+	// without it or if a row is not one of its problem's
+	const double **xd;
+	int d;
+
 	// svm_parameter
 	const int kernel_type;
 	const int degree;
 	const double gamma;
 	const double coef0;
+	const int mask;
 
-	static double dot(const svm_node *px, const svm_node *py);
+	static double dot(const svm_node *px, const svm_node *py, int mask);
+	double dot(int i, int j) const
+	{
+		return xd ? dense_dot(xd[i],xd[j],d,mask) : dot(x[i],x[j],mask);
+	}
+	void borrow_dense(int l, const svm_dense *dense);
 	double kernel_linear(int i, int j) const
 	{
-		return dot(x[i],x[j]);
+		return dot(i,j);
 	}
 	double kernel_poly(int i, int j) const
 	{
-		return powi(gamma*dot(x[i],x[j])+coef0,degree);
+		return powi(gamma*dot(i,j)+coef0,degree);
 	}
 	double kernel_rbf(int i, int j) const
 	{
-		return exp(-gamma*(x_square[i]+x_square[j]-2*dot(x[i],x[j])));
+		return exp(-gamma*(x_square[i]+x_square[j]-2*dot(i,j)));
 	}
 	double kernel_sigmoid(int i, int j) const
 	{
-		return tanh(gamma*dot(x[i],x[j])+coef0);
+		return tanh(gamma*dot(i,j)+coef0);
 	}
 	double kernel_precomputed(int i, int j) const
 	{
@@ -254,7 +581,7 @@ private:
 
 Kernel::Kernel(int l, svm_node * const * x_, const svm_parameter& param)
 :kernel_type(param.kernel_type), degree(param.degree),
- gamma(param.gamma), coef0(param.coef0)
+ gamma(param.gamma), coef0(param.coef0), mask(param.mask_feature)
 {
 	switch(kernel_type)
 	{
@@ -277,11 +604,16 @@ Kernel::Kernel(int l, svm_node * const * x_, const svm_parameter& param)
 
 	clone(x,x_,l);
 
+	xd = 0;
+	d = 0;
+	if(kernel_type != PRECOMPUTED && param.dense)
+		borrow_dense(l,param.dense);
+
 	if(kernel_type == RBF)
 	{
 		x_square = new double[l];
 		for(int i=0;i<l;i++)
-			x_square[i] = dot(x[i],x[i]);
+			x_square[i] = dot(i,i);
 	}
 	else
 		x_square = 0;
@@ -291,16 +623,70 @@ Kernel::~Kernel()
 {
 	delete[] x;
 	delete[] x_square;
+	delete[] xd;
+}
+
+void Kernel::fill_column(int i, Qfloat *data, int start, int len,
+			  const schar *y) const
+{
+	// blocks of rows worth handing to another thread
+	const int block = 256;
+	if(len-start < 2*block)
+	{
+		for(int j=start;j<len;j++)
+		{
+			double k = (this->*kernel_function)(i,j);
+			data[j] = (Qfloat)(y ? y[i]*y[j]*k : k);
+		}
+		return;
+	}
+	column_pool().run(len-start,block,[&](int begin, int end)
+	{
+		for(int j=start+begin;j<start+end;j++)
+		{
+			double k = (this->*kernel_function)(i,j);
+			data[j] = (Qfloat)(y ? y[i]*y[j]*k : k);
+		}
+	});
+}
+
+// point xd to the dense rows of x, if dense has all of them
+void Kernel::borrow_dense(int l, const svm_dense *dense)
+{
+	xd = new const double*[l];
+	for(int i=0;i<l;i++)
+	{
+		xd[i] = dense_row(dense,x[i]);
+		if(!xd[i])
+		{
+			delete[] xd;
+			xd = 0;
+			return;
+		}
+	}
+	d = dense->d;
 }
 
-double Kernel::dot(const svm_node *px, const svm_node *py)
+// mask: index of a feature to leave out (as if its value were zero)
+double Kernel::dot(const svm_node *px, const svm_node *py, int mask)
 {
 	double sum = 0;
+
+	// runs of the same indices (all of two dense rows) need no merging
+	while(px->index == py->index && px->index != -1)
+	{
+		if(px->index != mask)
+			sum += px->value * py->value;
+		++px;
+		++py;
+	}
+
 	while(px->index != -1 && py->index != -1)
 	{
 		if(px->index == py->index)
 		{
-			sum += px->value * py->value;
+			if(px->index != mask)
+				sum += px->value * py->value;
 			++px;
 			++py;
 		}
@@ -318,12 +704,13 @@ double Kernel::dot(const svm_node *px, const svm_node *py)
 double Kernel::k_function(const svm_node *x, const svm_node *y,
 			  const svm_parameter& param)
 {
+	const int mask = param.mask_feature;
 	switch(param.kernel_type)
 	{
 		case LINEAR:
-			return dot(x,y);
+			return dot(x,y,mask);
 		case POLY:
-			return powi(param.gamma*dot(x,y)+param.coef0,param.degree);
+			return powi(param.gamma*dot(x,y,mask)+param.coef0,param.degree);
 		case RBF:
 		{
 			double sum = 0;
@@ -332,7 +719,8 @@ double Kernel::k_function(const svm_node *x, const svm_node *y,
 				if(x->index == y->index)
 				{
 					double d = x->value - y->value;
-					sum += d*d;
+					if(x->index != mask)
+						sum += d*d;
 					++x;
 					++y;
 				}
@@ -340,12 +728,14 @@ double Kernel::k_function(const svm_node *x, const svm_node *y,
 				{
 					if(x->index > y->index)
 					{	
-						sum += y->value * y->value;
+						if(y->index != mask)
+							sum += y->value * y->value;
 						++y;
 					}
 					else
 					{
-						sum += x->value * x->value;
+						if(x->index != mask)
+							sum += x->value * x->value;
 						++x;
 					}
 				}
@@ -353,20 +743,22 @@ double Kernel::k_function(const svm_node *x, const svm_node *y,
 
 			while(x->index != -1)
 			{
-				sum += x->value * x->value;
+				if(x->index != mask)
+					sum += x->value * x->value;
 				++x;
 			}
 
 			while(y->index != -1)
 			{
-				sum += y->value * y->value;
+				if(y->index != mask)
+					sum += y->value * y->value;
 				++y;
 			}
 			
 			return exp(-param.gamma*sum);
 		}
 		case SIGMOID:
-			return tanh(param.gamma*dot(x,y)+param.coef0);
+			return tanh(param.gamma*dot(x,y,mask)+param.coef0);
 		case PRECOMPUTED:  //x: test (validation), y: SV
 			return x[(int)(y->value)].value;
 		default:
@@ -562,19 +954,20 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	int iter = 0;
 	int counter = min(l,1000)+1;
 
-	const clock_t timeout_clock_ticks = timeout * sysconf(_SC_CLK_TCK); // noto, timeout in clock ticks.
+	// noto, user-defined timeout.  Measured in CPU time of the calling thread
+	// since this solve started, so that solvers running concurrently (one per
+	// thread) do not use up each other's time
+	const double timeout_at = thread_cpu_seconds() + timeout;
 
 	while(1)
 	{
 
-		// noto, check for user-defined timeout, exit optimization if appropriate
-		struct tms elapsed_tms;
-		times(&elapsed_tms);
-		if ( elapsed_tms.tms_utime > timeout_clock_ticks ) { break; }
-		
 		// show progress and do shrinking
 		if(--counter == 0)
 		{
+			// noto, check for user-defined timeout, exit optimization if appropriate
+			if ( thread_cpu_seconds() > timeout_at ) { break; }
+
 			counter = min(l,1000);
 			if(shrinking) do_shrinking();
 			info("."); 
@@ -1276,12 +1669,9 @@ public:
 	Qfloat *get_Q(int i, int len) const
 	{
 		Qfloat *data;
-		int start, j;
+		int start;
 		if((start = cache->get_data(i,&data,len)) < len)
-		{
-			for(j=start;j<len;j++)
-				data[j] = (Qfloat)(y[i]*y[j]*(this->*kernel_function)(i,j));
-		}
+			fill_column(i,data,start,len,y);
 		return data;
 	}
 
@@ -1325,12 +1715,9 @@ public:
 	Qfloat *get_Q(int i, int len) const
 	{
 		Qfloat *data;
-		int start, j;
+		int start;
 		if((start = cache->get_data(i,&data,len)) < len)
-		{
-			for(j=start;j<len;j++)
-				data[j] = (Qfloat)(this->*kernel_function)(i,j);
-		}
+			fill_column(i,data,start,len);
 		return data;
 	}
 
@@ -1393,10 +1780,7 @@ public:
 		Qfloat *data;
 		int j, real_i = index[i];
 		if(cache->get_data(real_i,&data,l) < l)
-		{
-			for(j=0;j<l;j++)
-				data[j] = (Qfloat)(this->*kernel_function)(real_i,j);
-		}
+			fill_column(real_i,data,0,l);
 
 		// reorder and copy
 		Qfloat *buf = buffer[next_buffer];
@@ -1431,6 +1815,98 @@ private:
 	double *QD;
 };
 
+// SVR_Q of the leave-one-out folds of one problem.  The kernel and its
+// cache are over the whole problem, so a column computed for one fold is
+// reused by every later fold; set_fold picks the l-1 instances in use.
+class SVR_LOO_Q: public Kernel
+{
+public:
+	SVR_LOO_Q(const svm_problem& prob, const svm_parameter& param)
+	:Kernel(prob.l, prob.x, param)
+	{
+		l = prob.l;
+		cache = new Cache(l,(long int)(param.cache_size*(1<<20)));
+		diag = new double[l];
+		for(int k=0;k<l;k++)
+			diag[k] = (this->*kernel_function)(k,k);
+		QD = new double[2*l];
+		sign = new schar[2*l];
+		index = new int[2*l];
+		buffer[0] = new Qfloat[2*l];
+		buffer[1] = new Qfloat[2*l];
+		next_buffer = 0;
+	}
+
+	// variables k and k+l-1 are alpha+ and alpha- of the k-th instance
+	// other than left_out
+	void set_fold(int left_out)
+	{
+		int m = l-1;
+		for(int k=0;k<m;k++)
+		{
+			int real_k = k < left_out ? k : k+1;
+			sign[k] = 1;
+			sign[k+m] = -1;
+			index[k] = real_k;
+			index[k+m] = real_k;
+			QD[k] = diag[real_k];
+			QD[k+m] = diag[real_k];
+		}
+	}
+
+	double kernel(int i, int j) const
+	{
+		return (this->*kernel_function)(i,j);
+	}
+
+	void swap_index(int i, int j) const
+	{
+		swap(sign[i],sign[j]);
+		swap(index[i],index[j]);
+		swap(QD[i],QD[j]);
+	}
+
+	Qfloat *get_Q(int i, int len) const
+	{
+		Qfloat *data;
+		int j, real_i = index[i];
+		if(cache->get_data(real_i,&data,l) < l)
+			fill_column(real_i,data,0,l);
+
+		Qfloat *buf = buffer[next_buffer];
+		next_buffer = 1 - next_buffer;
+		schar si = sign[i];
+		for(j=0;j<len;j++)
+			buf[j] = (Qfloat) si * (Qfloat) sign[j] * data[index[j]];
+		return buf;
+	}
+
+	double *get_QD() const
+	{
+		return QD;
+	}
+
+	~SVR_LOO_Q()
+	{
+		delete cache;
+		delete[] sign;
+		delete[] index;
+		delete[] buffer[0];
+		delete[] buffer[1];
+		delete[] QD;
+		delete[] diag;
+	}
+private:
+	int l;
+	Cache *cache;
+	schar *sign;
+	int *index;
+	mutable int next_buffer;
+	Qfloat *buffer[2];
+	double *QD;
+	double *diag;
+};
+
 //
 // construct and solve various formulations
 //
@@ -2073,6 +2549,8 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 	svm_model *model = Malloc(svm_model,1);
 	model->param = *param;
 	model->free_sv = 0;	// XXX
+	model->w = NULL;
+	model->w_len = 0;
 
 	if(param->svm_type == ONE_CLASS ||
 	   param->svm_type == EPSILON_SVR ||
@@ -2420,6 +2898,99 @@ void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, i
 	free(perm);	
 }
 
+// Leave-one-out for epsilon-SVR, warm-started from model, the solution on
+// all of prob (NULL for a cold start).  Each fold starts from the full
+// solution with the left-out coefficient moved onto other instances, which
+// keeps the start feasible, and all folds share one kernel cache.
+void svm_leave_one_out(const svm_problem *prob, const svm_parameter *param, const svm_model *model, double *target)
+{
+	int l = prob->l;
+	if(param->svm_type != EPSILON_SVR || l < 2)
+	{
+		svm_cross_validation(prob,param,l,target);
+		return;
+	}
+
+	int i, j, k;
+	double C = param->C;
+
+	// the full solution per instance; SVs are in instance order.  A model
+	// that is not over prob (e.g. a loaded one) gives a cold start
+	double *beta = Malloc(double,l);
+	j = 0;
+	for(i=0;i<l;i++)
+	{
+		beta[i] = 0;
+		if(model && j < model->l && model->SV[j] == prob->x[i] &&
+		   fabs(model->sv_coef[0][j]) <= C)
+			beta[i] = model->sv_coef[0][j++];
+	}
+	if(!model || j != model->l)
+		for(i=0;i<l;i++)
+			beta[i] = 0;
+
+	SVR_LOO_Q Q(*prob,*param);
+	int m = l-1;
+	double *fold_beta = new double[l];
+	double *alpha2 = new double[2*m];
+	double *linear_term = new double[2*m];
+	schar *y = new schar[2*m];
+
+	for(k=0;k<l;k++)
+	{
+		// move beta[k] onto the others, free SVs first, within [-C,C]
+		for(i=0;i<l;i++)
+			fold_beta[i] = beta[i];
+		fold_beta[k] = 0;
+		double r = beta[k];
+		for(int pass=0;pass<2 && r != 0;pass++)
+			for(i=0;i<l && r != 0;i++)
+			{
+				bool free_sv = fold_beta[i] != 0 && fabs(fold_beta[i]) < C;
+				if(i == k || free_sv != (pass == 0))
+					continue;
+				double room = r > 0 ? C - fold_beta[i] : -C - fold_beta[i];
+				double move = fabs(room) < fabs(r) ? room : r;
+				fold_beta[i] += move;
+				r -= move;
+			}
+
+		Q.set_fold(k);
+		for(i=0;i<m;i++)
+		{
+			int real_i = i < k ? i : i+1;
+			alpha2[i] = max(fold_beta[real_i],0.0);
+			linear_term[i] = param->p - prob->y[real_i];
+			y[i] = 1;
+
+			alpha2[i+m] = max(-fold_beta[real_i],0.0);
+			linear_term[i+m] = param->p + prob->y[real_i];
+			y[i+m] = -1;
+		}
+
+		Solver s;
+		Solver::SolutionInfo si;
+		s.Solve(2*m, Q, linear_term, y,
+			alpha2, C, C, param->eps, &si, param->shrinking, param->timeout);
+
+		// predict instance k as svm_predict would with the fold's model
+		double sum = -si.rho;
+		for(i=0;i<m;i++)
+		{
+			double a = alpha2[i] - alpha2[i+m];
+			if(a != 0)
+				sum += a * Q.kernel(i < k ? i : i+1, k);
+		}
+		target[k] = sum;
+	}
+
+	free(beta);
+	delete[] fold_beta;
+	delete[] alpha2;
+	delete[] linear_term;
+	delete[] y;
+}
+
 
 int svm_get_svm_type(const svm_model *model)
 {
@@ -2450,16 +3021,88 @@ double svm_get_svr_probability(const svm_model *model)
 	}
 }
 
+// A LINEAR model with one decision function is sum_i sv_coef[i] <SV[i], x>
+// = <w, x>, so keep w = sum_i sv_coef[i] SV[i] (without the masked feature)
+// and predict with one dot product instead of one per SV.  SVs whose
+// indices do not ascend (which the SV-by-SV dot products pair by position)
+// leave the model without w, and so does a w as long as the SVs' nodes
+// together, which would cost more memory than the sum it replaces.
+// svm_train does not collapse: callers collapse the models that predict
+// many instances, not cross-validation folds.
+void svm_collapse_linear(svm_model *model)
+{
+	free(model->w);
+	model->w = NULL;
+	model->w_len = 0;
+	if(model->param.kernel_type != LINEAR ||
+	   (model->param.svm_type != ONE_CLASS &&
+	    model->param.svm_type != EPSILON_SVR &&
+	    model->param.svm_type != NU_SVR))
+		return;
+
+	int w_len = 1;
+	long nodes = 0;
+	for(int i=0;i<model->l;i++)
+	{
+		int last = 0;
+		for(const svm_node *p=model->SV[i];p->index!=-1;p++)
+		{
+			if(p->index <= last)
+				return;
+			last = p->index;
+			nodes++;
+		}
+		w_len = max(w_len,last+1);
+	}
+	if(w_len >= nodes)
+		return;
+
+	double *w = Malloc(double,w_len);
+	for(int k=0;k<w_len;k++)
+		w[k] = 0;
+	const double *sv_coef = model->sv_coef[0];
+	for(int i=0;i<model->l;i++)
+		for(const svm_node *p=model->SV[i];p->index!=-1;p++)
+			w[p->index] += sv_coef[i] * p->value;
+	if(model->param.mask_feature > 0 && model->param.mask_feature < w_len)
+		w[model->param.mask_feature] = 0;
+	model->w = w;
+	model->w_len = w_len;
+}
+
+// <w, x>; 0 (and the SV-by-SV sum is used) if x's indices do not ascend
+static int linear_decision(const svm_model *model, const svm_node *x, double *sum)
+{
+	const double *w = model->w;
+	const int w_len = model->w_len;
+	double s = 0;
+	int last = 0;
+	for(;x->index!=-1;x++)
+	{
+		if(x->index <= last)
+			return 0;
+		last = x->index;
+		if(last < w_len)
+			s += w[last] * x->value;
+	}
+	*sum = s;
+	return 1;
+}
+
 double svm_predict_values(const svm_model *model, const svm_node *x, double* dec_values)
 {
 	if(model->param.svm_type == ONE_CLASS ||
 	   model->param.svm_type == EPSILON_SVR ||
 	   model->param.svm_type == NU_SVR)
 	{
-		double *sv_coef = model->sv_coef[0];
-		double sum = 0;
-		for(int i=0;i<model->l;i++)
-			sum += sv_coef[i] * Kernel::k_function(x,model->SV[i],model->param);
+		double sum;
+		if(!model->w || !linear_decision(model,x,&sum))
+		{
+			double *sv_coef = model->sv_coef[0];
+			sum = 0;
+			for(int i=0;i<model->l;i++)
+				sum += sv_coef[i] * Kernel::k_function(x,model->SV[i],model->param);
+		}
 		sum -= model->rho[0];
 		*dec_values = sum;
 
@@ -2609,6 +3252,9 @@ int svm_save_model(const char *model_file_name, const svm_model *model)
 	if(param.kernel_type == POLY || param.kernel_type == SIGMOID)
 		fprintf(fp,"coef0 %g\n", param.coef0);
 
+	if(param.mask_feature)
+		fprintf(fp,"mask_feature %d\n", param.mask_feature);
+
 	int nr_class = model->nr_class;
 	int l = model->l;
 	fprintf(fp, "nr_class %d\n", nr_class);
@@ -2707,11 +3353,15 @@ svm_model *svm_load_model(const char *model_file_name)
 
 	svm_model *model = Malloc(svm_model,1);
 	svm_parameter& param = model->param;
+	param.mask_feature = 0;
+	param.dense = NULL;
 	model->rho = NULL;
 	model->probA = NULL;
 	model->probB = NULL;
 	model->label = NULL;
 	model->nSV = NULL;
+	model->w = NULL;
+	model->w_len = 0;
 
 	char cmd[81];
 	while(1)
@@ -2768,6 +3418,8 @@ svm_model *svm_load_model(const char *model_file_name)
 			fscanf(fp,"%lf",&param.gamma);
 		else if(strcmp(cmd,"coef0")==0)
 			fscanf(fp,"%lf",&param.coef0);
+		else if(strcmp(cmd,"mask_feature")==0)
+			fscanf(fp,"%d",&param.mask_feature);
 		else if(strcmp(cmd,"nr_class")==0)
 			fscanf(fp,"%d",&model->nr_class);
 		else if(strcmp(cmd,"total_sv")==0)
@@ -2895,6 +3547,7 @@ svm_model *svm_load_model(const char *model_file_name)
 		return NULL;
 
 	model->free_sv = 1;	// XXX
+	svm_collapse_linear(model);
 	return model;
 }
 
@@ -2911,6 +3564,9 @@ void svm_free_model_content(svm_model* model_ptr)
 	free(model_ptr->SV);
 	model_ptr->SV = NULL;
 
+	free(model_ptr->w);
+	model_ptr->w = NULL;
+
 	free(model_ptr->sv_coef);
 	model_ptr->sv_coef = NULL;
 
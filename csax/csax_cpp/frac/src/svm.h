@@ -26,6 +26,8 @@ struct svm_problem
 enum { C_SVC, NU_SVC, ONE_CLASS, EPSILON_SVR, NU_SVR };	/* svm_type */   //noto, only EPSILON_SVR, NU_SVR are used in this version, FRaC
 enum { LINEAR, POLY, RBF, SIGMOID, PRECOMPUTED }; /* kernel_type */
 
+struct svm_dense; /* see svm_dense_alloc */
+
 struct svm_parameter
 {
 
@@ -53,6 +55,9 @@ struct svm_parameter
 
 	int timeout; // noto, solver optimization timeout (seconds)
 
+	int mask_feature; // (1-origin) feature the kernel treats as zero, so one shared problem can serve every feature model; 0 for none
+	struct svm_dense *dense; // dense copy of the training problem (see svm_dense_alloc), only read by the kernel; NULL for none
+
 	// FRaC parameters
 	
 	unsigned int folds; // noto, number of cross-validation folds if no validation set is given
@@ -63,6 +68,9 @@ struct svm_parameter
 	unsigned int f1; // first feature to do
 	unsigned int fD; // last feature to do
 
+	int gram; // derive each feature's kernel from one Gram matrix of all features (see fraclib.h), 0 to evaluate it per feature
+	int ridge; // ridge regression feature models with closed-form leave-one-out errors (see fraclib.h), 0 for SVRs
+
 };
 	
 
@@ -88,10 +96,14 @@ struct svm_model
 	/* XXX */
 	int free_sv;		/* 1 if svm_model is created by svm_load_model*/
 				/* 0 if svm_model is created by svm_train */
+
+	double *w;		/* LINEAR one-function models: sum of sv_coef*SV by index (w[w_len]), */
+	int w_len;		/* which svm_predict uses; NULL if none (see svm_collapse_linear) */
 };
 
 struct svm_model *svm_train(const struct svm_problem *prob, const struct svm_parameter *param);
 void svm_cross_validation(const struct svm_problem *prob, const struct svm_parameter *param, int nr_fold, double *target);
+void svm_leave_one_out(const struct svm_problem *prob, const struct svm_parameter *param, const struct svm_model *model, double *target);
 
 int svm_save_model(const char *model_file_name, const struct svm_model *model);
 struct svm_model *svm_load_model(const char *model_file_name);
@@ -105,6 +117,7 @@ double svm_predict_values(const struct svm_model *model, const struct svm_node *
 double svm_predict(const struct svm_model *model, const struct svm_node *x);
 double svm_predict_probability(const struct svm_model *model, const struct svm_node *x, double* prob_estimates);
 
+void svm_collapse_linear(struct svm_model *model); /* set w of a model that predicts many instances */
 void svm_free_model_content(struct svm_model *model_ptr);
 void svm_free_and_destroy_model(struct svm_model **model_ptr_ptr);
 void svm_destroy_param(struct svm_parameter *param);
@@ -114,6 +127,21 @@ int svm_check_probability_model(const struct svm_model *model);
 
 void svm_set_print_string_function(void (*print_func)(const char *));
 
+/* Aligned dense copy of a problem whose rows are all features 1..d (NULL for
+   any other problem), made once and shared read-only by every thread through
+   svm_parameter.dense.  Kernels over rows of that problem (views, folds,
+   feature models) evaluate dot products on it instead of merging the rows'
+   node lists; their rows must be the problem's own row pointers. */
+struct svm_dense *svm_dense_alloc(const struct svm_problem *prob);
+void svm_dense_free(struct svm_dense *dense);
+
+/* Threads for the kernel columns of large problems, shared by all solvers.
+   n is the budget of the whole process, callers included (default 1);
+   threads an application runs solvers on hold one each while they do. */
+void svm_set_num_threads(int n);
+void svm_hold_threads(int n);
+void svm_release_threads(int n);
+
 #ifdef __cplusplus
 }
 #endif
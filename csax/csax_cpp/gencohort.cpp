@@ -0,0 +1,250 @@
+// Synthetic cohort generator
+// Writes a training set, a test set (with labels) and a gene set database in
+// the CSAX input formats, for benchmarks at any scale
+//
+// Genes belong to modules that share a latent factor, so every gene can be
+// predicted from the rest of its module, as FRaC expects of real expression
+// data. Each gene set is drawn mostly from one module. Anomalous test samples
+// have the genes of a few modules decoupled from their factor.
+
+#include <stdlib.h>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct CohortOptions {
+    unsigned genes;
+    unsigned training;
+    unsigned test;
+    unsigned sets;
+    unsigned min_size;
+    unsigned max_size;
+    unsigned modules;
+    double anomalous;
+    unsigned seed;
+};
+
+void usage(ostream &out)
+{
+    out << "Usage: ./gencohort [options] <output prefix>" << endl
+        << "  writes <prefix>.training.set, <prefix>.test.set,"
+        << " <prefix>.test.set.labels" << endl
+        << "  and <prefix>.gmt" << endl
+        << "  -g <integer>  genes (default 1000)" << endl
+        << "  -n <integer>  training samples (default 40)" << endl
+        << "  -t <integer>  test samples (default 20)" << endl
+        << "  -s <integer>  gene sets (default 200)" << endl
+        << "  -m <integer>  smallest gene set (default 10)" << endl
+        << "  -M <integer>  largest gene set (default 100, at most the genes)"
+        << endl
+        << "  -c <integer>  gene modules (default: genes / 20)" << endl
+        << "  -a <real>     fraction of anomalous test samples (default 0.5)"
+        << endl
+        << "  -S <integer>  seed (default 1)" << endl;
+}
+
+/*Samples are drawn as columns, [sample][gene]; each gene row is min-max
+ *scaled to [0, 1] over the training samples, like the example inputs
+ */
+typedef vector<vector<double> > Cohort;
+
+vector<double> drawSample(const CohortOptions &options,
+        const vector<unsigned> &module, const vector<double> &loading,
+        const vector<bool> &decoupled, mt19937 &rng)
+{
+    normal_distribution<double> normal(0, 1);
+    vector<double> factor(options.modules);
+    for (unsigned c = 0; c < options.modules; c++) {
+        factor[c] = normal(rng);
+    }
+    vector<double> sample(options.genes);
+    for (unsigned j = 0; j < options.genes; j++) {
+        unsigned c = module[j];
+        double f = decoupled[c] ? normal(rng) * 2 : factor[c];
+        sample[j] = loading[j] * f + 0.3 * normal(rng);
+    }
+    return sample;
+}
+
+void writeMatrix(string filename, string prefix, const Cohort &samples,
+        const vector<double> &low, const vector<double> &high)
+{
+    ofstream f(filename);
+    if (!f.is_open()) {
+        cerr << "Could not write " << filename << endl;
+        exit(1);
+    }
+    for (unsigned i = 0; i < samples.size(); i++) {
+        f << (i ? "\t" : "") << prefix << i + 1;
+    }
+    f << "\n";
+    f.precision(8);
+    for (unsigned j = 0; j < low.size(); j++) {
+        f << "G" << j + 1;
+        double range = high[j] > low[j] ? high[j] - low[j] : 1;
+        for (unsigned i = 0; i < samples.size(); i++) {
+            f << "\t" << (samples[i][j] - low[j]) / range;
+        }
+        f << "\n";
+    }
+}
+
+void writeGeneSets(string filename, const CohortOptions &options,
+        const vector<vector<unsigned> > &members, mt19937 &rng)
+{
+    ofstream f(filename);
+    if (!f.is_open()) {
+        cerr << "Could not write " << filename << endl;
+        exit(1);
+    }
+    uniform_int_distribution<unsigned> size(options.min_size,
+            options.max_size);
+    uniform_int_distribution<unsigned> anyGene(0, options.genes - 1);
+    uniform_real_distribution<double> unit(0, 1);
+    for (unsigned s = 0; s < options.sets; s++) {
+        // Three quarters of a set comes from one module, the rest from
+        // anywhere; genes are listed once
+        const vector<unsigned> &home = members[s % options.modules];
+        unsigned n = size(rng);
+        vector<bool> in(options.genes, false);
+        vector<unsigned> genes;
+        for (unsigned k = 0; k < n * 4 && genes.size() < n; k++) {
+            unsigned j = unit(rng) < .75 ?
+                home[rng() % home.size()] : anyGene(rng);
+            if (!in[j]) {
+                in[j] = true;
+                genes.push_back(j);
+            }
+        }
+        f << "S" << s + 1 << "\tsynthetic set " << s + 1;
+        for (unsigned k = 0; k < genes.size(); k++) {
+            f << "\tG" << genes[k] + 1;
+        }
+        f << "\n";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    CohortOptions options;
+    options.genes = 1000;
+    options.training = 40;
+    options.test = 20;
+    options.sets = 200;
+    options.min_size = 10;
+    options.max_size = 100;
+    options.modules = 0;
+    options.anomalous = 0.5;
+    options.seed = 1;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        string option = argv[i];
+        if (option == "-h") {
+            usage(cout);
+            exit(0);
+        }
+        if (i + 1 >= argc) {
+            usage(cerr);
+            exit(1);
+        }
+        if (option == "-g") {
+            options.genes = atoi(argv[++i]);
+        } else if (option == "-n") {
+            options.training = atoi(argv[++i]);
+        } else if (option == "-t") {
+            options.test = atoi(argv[++i]);
+        } else if (option == "-s") {
+            options.sets = atoi(argv[++i]);
+        } else if (option == "-m") {
+            options.min_size = atoi(argv[++i]);
+        } else if (option == "-M") {
+            options.max_size = atoi(argv[++i]);
+        } else if (option == "-c") {
+            options.modules = atoi(argv[++i]);
+        } else if (option == "-a") {
+            options.anomalous = atof(argv[++i]);
+        } else if (option == "-S") {
+            options.seed = strtoul(argv[++i], NULL, 10);
+        } else {
+            cerr << "Unknown option: " << option << endl;
+            usage(cerr);
+            exit(1);
+        }
+    }
+    if (argc - i != 1) {
+        usage(cerr);
+        exit(1);
+    }
+    if (options.modules == 0) {
+        options.modules = options.genes / 20 > 0 ? options.genes / 20 : 1;
+    }
+    if (options.max_size > options.genes) {
+        options.max_size = options.genes;
+    }
+    if (options.genes < 2 || options.training < 2 || options.test < 1 ||
+            options.modules > options.genes || options.min_size < 1 ||
+            options.min_size > options.max_size) {
+        cerr << "Need at least 2 genes and training samples, 1 test sample,"
+             << " at most one module per gene and 1 <= -m <= -M"
+             << endl;
+        exit(1);
+    }
+    string prefix = argv[i];
+    mt19937 rng(options.seed);
+
+    // Genes are dealt to modules round-robin, each with its own loading
+    vector<unsigned> module(options.genes);
+    vector<double> loading(options.genes);
+    vector<vector<unsigned> > members(options.modules);
+    uniform_real_distribution<double> strength(0.5, 1.5);
+    for (unsigned j = 0; j < options.genes; j++) {
+        module[j] = j % options.modules;
+        loading[j] = strength(rng) * (rng() % 2 ? 1 : -1);
+        members[module[j]].push_back(j);
+    }
+
+    vector<bool> normal(options.modules, false);
+    Cohort training;
+    for (unsigned s = 0; s < options.training; s++) {
+        training.push_back(drawSample(options, module, loading, normal, rng));
+    }
+
+    // An anomalous sample has one to three of its modules decoupled
+    Cohort test;
+    vector<int> labels;
+    uniform_real_distribution<double> unit(0, 1);
+    for (unsigned s = 0; s < options.test; s++) {
+        vector<bool> decoupled(options.modules, false);
+        int label = unit(rng) < options.anomalous;
+        if (label) {
+            unsigned count = 1 + rng() % 3;
+            for (unsigned k = 0; k < count; k++) {
+                decoupled[rng() % options.modules] = true;
+            }
+        }
+        test.push_back(drawSample(options, module, loading, decoupled, rng));
+        labels.push_back(label);
+    }
+
+    // Scaled by the training range, so test values can fall outside [0, 1]
+    vector<double> low(options.genes), high(options.genes);
+    for (unsigned j = 0; j < options.genes; j++) {
+        low[j] = high[j] = training[0][j];
+        for (unsigned s = 1; s < options.training; s++) {
+            low[j] = min(low[j], training[s][j]);
+            high[j] = max(high[j], training[s][j]);
+        }
+    }
+    writeMatrix(prefix + ".training.set", "N", training, low, high);
+    writeMatrix(prefix + ".test.set", "U", test, low, high);
+    ofstream labelFile(prefix + ".test.set.labels");
+    for (unsigned s = 0; s < labels.size(); s++) {
+        labelFile << labels[s] << "\n";
+    }
+    writeGeneSets(prefix + ".gmt", options, members, rng);
+    return 0;
+}
@@ -3,76 +3,177 @@
 // Gene Set Manager Implementation
 
 #include "genesetmanager.h"
-#include <map>
 #include <iostream>
 #include <math.h>
 #include <algorithm>
+#include <atomic>
+#include <thread>
 using namespace std;
 
-/*Sort function using C++ included sort*/
-bool sortfunction (GeneSet *a, GeneSet *b) {
-    unsigned size;
-    if (a->median == -1) {
-        std::sort(a->rankings.begin(), a->rankings.end());
-        size = a->rankings.size();
-        if (size % 2 == 0) {
-            a->median = (a->rankings[size / 2 - 1] +
-                a->rankings[size / 2]) / 2;
+GeneSetManager::GeneSetManager(unsigned numTests, unsigned numSets)
+{
+    this->numSets = numSets;
+    histograms.resize((size_t)numTests * numSets);
+    counts.assign((size_t)numTests * numSets, 0);
+    seen.resize(numTests);
+    weightsGamma = NAN;
+}
+
+/*Adds one bag's ranking of one test sample's gene sets (set ids, most
+ *enriched first; the first has rank 1)
+ */
+void GeneSetManager::addRankings(unsigned test, const vector<unsigned> &ranked)
+{
+    size_t cells = (size_t)test * numSets;
+    for (unsigned j = 0; j < ranked.size(); j++) {
+        size_t cell = cells + ranked[j];
+        if (counts[cell]++ == 0) {
+            seen[test].push_back(ranked[j]);
+        }
+        int rank = j + 1;
+        vector<RankCount> &histogram = histograms[cell];
+        auto it = lower_bound(histogram.begin(), histogram.end(), rank,
+                [](const RankCount &r, int rank) { return r.rank < rank; });
+        if (it != histogram.end() && it->rank == rank) {
+            it->count++;
         } else {
-            a->median = a->rankings[size / 2];
+            RankCount r = {rank, 1};
+            histogram.insert(it, r);
         }
     }
-    if (b->median == -1) {
-        std::sort(b->rankings.begin(), b->rankings.end());
-        size = b->rankings.size();
-        if (size % 2 == 0) {
-            b->median = (b->rankings[size / 2 - 1] +
-                b->rankings[size / 2]) / 2;
-        } else {
-            b->median = b->rankings[size / 2];
+}
+
+/*Median rank of a set over the bags that ranked it (the lower middle ranks
+ *are averaged in integers, as before), read off its histogram
+ */
+float GeneSetManager::median(unsigned test, unsigned set)
+{
+    size_t cell = (size_t)test * numSets + set;
+    const vector<RankCount> &histogram = histograms[cell];
+    unsigned size = counts[cell];
+    // 0-origin positions of the middle ranks in sorted order
+    unsigned upperPos = size / 2;
+    unsigned lowerPos = (size % 2 == 0) ? upperPos - 1 : upperPos;
+    int lower = 0, upper = 0;
+    unsigned below = 0; // ranks before the current bin
+    for (unsigned k = 0; k < histogram.size(); k++) {
+        unsigned next = below + histogram[k].count;
+        if (lowerPos >= below && lowerPos < next) {
+            lower = histogram[k].rank;
+        }
+        if (upperPos >= below && upperPos < next) {
+            upper = histogram[k].rank;
+            break;
         }
+        below = next;
     }
-    return a->median < b->median;
+    return (lower + upper) / 2;
 }
 
-GeneSetManager::GeneSetManager() {
+/*The ranked sets of a test sample, by median rank */
+vector<unsigned> GeneSetManager::sortByMedian(unsigned test)
+{
+    vector<float> medians(numSets);
+    return sortByMedian(test, medians.data());
 }
 
-/*Adds a ranking to the manager */
-void GeneSetManager::addRankingToGeneset(int ranking, string geneset)
+/*Same, with the medians of the ranked sets left in medians (one per set id)
+ */
+vector<unsigned> GeneSetManager::sortByMedian(unsigned test, float *medians)
 {
-    GeneSet *g;
-    if (genesetmap.count(geneset) == 0) {
-        g = new GeneSet;
-        g->name = geneset;
-        g->median = -1; // Flag that median has not been found
-        genesets.push_back(g);
-        genesetmap[geneset] = g;
+    for (unsigned i = 0; i < seen[test].size(); i++) {
+        unsigned set = seen[test][i];
+        medians[set] = median(test, set);
     }
-    g = genesetmap[geneset];
-    g->rankings.push_back(ranking);
+    vector<unsigned> order = seen[test];
+    std::sort(order.begin(), order.end(), [medians](unsigned a, unsigned b)
+            { return medians[a] < medians[b]; });
+    return order;
 }
 
-/*Sorting wrapper function */
-void GeneSetManager::sortByMedian()
+/*Fills the table of discounts gamma^i, i < numSets */
+void GeneSetManager::setGamma(double gamma)
 {
-    std::sort(genesets.begin(), genesets.end(), sortfunction);
+    if (gamma == weightsGamma) {
+        return;
+    }
+    weights.resize(numSets);
+    for (unsigned i = 0; i < numSets; i++) {
+        weights[i] = pow(gamma, i);
+    }
+    weightsGamma = gamma;
 }
 
 /*Calculates anomaly score for a given enrichment score map using a gamma value
+ *ES has one score per set id, NaN for sets without (positive) enrichment
  * */
-double GeneSetManager::getAnomalyScore(double gamma, map<string, double> *ES)
+double GeneSetManager::getAnomalyScore(unsigned test, double gamma,
+        const vector<double> &ES)
+{
+    setGamma(gamma);
+    return discountedScore(sortByMedian(test), ES);
+}
+
+/*Sum of gamma^i * ES over the sets in median rank order (weights has to be
+ *set)
+ */
+double GeneSetManager::discountedScore(const vector<unsigned> &order,
+        const vector<double> &ES)
 {
-    sortByMedian();
     double total_score = 0;
-    double cur_score = 0;
-    for (unsigned i = 0; i < genesets.size(); i++) {
-        if (ES->count(genesets[i]->name) == 0) {
-            continue;
-        } else {
-            cur_score = ES->at(genesets[i]->name);
-            total_score += cur_score * pow(gamma, i);
-        }
+    for (unsigned i = 0; i < order.size(); i++) {
+        double cur_score = ES[order[i]];
+        total_score += (std::isnan(cur_score) ? 0 : cur_score) * weights[i];
     }
     return total_score;
 }
+
+/*Anomaly scores of all test samples (ES is [test][set]) in one pass, split
+ *over jobs threads. Each thread reuses one row of medians and the weights
+ *are set once, so a sample costs its medians, one sort and one dot product;
+ *each score equals getAnomalyScore's.
+ */
+vector<double> GeneSetManager::getAnomalyScores(double gamma,
+        const vector<vector<double> > &ES, unsigned jobs)
+{
+    unsigned numTests = seen.size();
+    setGamma(gamma);
+    vector<double> scores(numTests);
+    atomic<unsigned> next(0);
+
+    auto worker = [&]() {
+        vector<float> medians(numSets);
+        unsigned test;
+        while ((test = next++) < numTests) {
+            vector<unsigned> order = sortByMedian(test, medians.data());
+            scores[test] = discountedScore(order, ES[test]);
+        }
+    };
+
+    vector<thread> pool;
+    for (unsigned t = 1; t < jobs && t < numTests; t++) {
+        pool.push_back(thread(worker));
+    }
+    worker();
+    for (unsigned t = 0; t < pool.size(); t++) {
+        pool[t].join();
+    }
+    return scores;
+}
+
+/*The terms of the anomaly score: each ranked set with gamma^i * ES, in
+ *median rank order (sets without enrichment contribute 0)
+ */
+vector<pair<unsigned, double> > GeneSetManager::getContributions(
+        unsigned test, double gamma, const vector<double> &ES)
+{
+    vector<unsigned> order = sortByMedian(test);
+    setGamma(gamma);
+    vector<pair<unsigned, double> > terms(order.size());
+    for (unsigned i = 0; i < order.size(); i++) {
+        double cur_score = ES[order[i]];
+        terms[i].first = order[i];
+        terms[i].second = std::isnan(cur_score) ? 0 : cur_score * weights[i];
+    }
+    return terms;
+}
@@ -5,26 +5,47 @@
 #ifndef GENESETMANAGER_H
 #define GENESETMANAGER_H
 
-#include <map>
 #include <vector>
 #include <iostream>
 using namespace std;
 
-struct GeneSet {
-    string name;
-    vector<int> rankings;
-    float median;
+/*how often one rank was given to a gene set */
+struct RankCount {
+    int rank;
+    unsigned count;
 };
 
+/*Collects the gene set rankings of every bag for every test sample and
+ *turns them into anomaly scores.
+ *Gene sets are the ids of the GSEA object (the .gmt order). Ranks are small
+ *integers (1..number of sets), so each (test sample, gene set) keeps a
+ *histogram of its ranks instead of every bag's rank: memory is bounded by
+ *the number of distinct ranks, not the number of bags, and exact medians
+ *(and so scores) can be read at any point of the run.
+ */
 class GeneSetManager {
     public:
-        GeneSetManager();
-        void addRankingToGeneset(int ranking, string geneset);
-        void sortByMedian();
-        double getAnomalyScore(double gamma, map<string, double> *ES);
+        GeneSetManager(unsigned numTests, unsigned numSets);
+        void addRankings(unsigned test, const vector<unsigned> &ranked);
+        vector<unsigned> sortByMedian(unsigned test);
+        double getAnomalyScore(unsigned test, double gamma,
+                const vector<double> &ES);
+        vector<double> getAnomalyScores(double gamma,
+                const vector<vector<double> > &ES, unsigned jobs);
+        vector<pair<unsigned, double> > getContributions(unsigned test,
+                double gamma, const vector<double> &ES);
     private:
-        vector<GeneSet*> genesets;
-        map<string, GeneSet*> genesetmap;
+        float median(unsigned test, unsigned set);
+        vector<unsigned> sortByMedian(unsigned test, float *medians);
+        double discountedScore(const vector<unsigned> &order,
+                const vector<double> &ES);
+        void setGamma(double gamma);
+        unsigned numSets;
+        vector<vector<RankCount> > histograms; // [test][set], by rank
+        vector<unsigned> counts;               // [test][set], bags that ranked it
+        vector<vector<unsigned> > seen;        // sets of each test, as first ranked
+        vector<double> weights;                // gamma^i
+        double weightsGamma;
 };
 
 #endif
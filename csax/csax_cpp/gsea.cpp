@@ -0,0 +1,321 @@
+// Native preranked GSEA Implementation
+// Weighted running-sum enrichment scores, as computed by GseaPreranked with
+// -scoring_scheme weighted -norm meandiv, and gene set permutations for NES
+// and nominal p-values
+
+#include "gsea.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <iostream>
+#include <sstream>
+#include <random>
+#include <thread>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+using namespace std;
+
+/*GSEA upper-cases the ranked list's gene symbols but not the .gmt members
+ *(so e.g. the viral "tat" of the HIV sets matches nothing)
+ */
+static string toUpper(string s)
+{
+    for (unsigned i = 0; i < s.length(); i++) {
+        s[i] = toupper(s[i]);
+    }
+    return s;
+}
+
+/*Enrichment score of one set given the (ascending) ranks of its m members,
+ *and the weights |score| of the ranked list of N genes, in rank order.
+ *The running sum only changes direction at hits, so its extremes are found
+ *just before (minimum) and just after (maximum) each hit.
+ */
+static double runningSumES(const unsigned *pos, unsigned m,
+        const double *weights, unsigned N)
+{
+    double NR = 0;
+    for (unsigned k = 0; k < m; k++) {
+        NR += weights[pos[k]];
+    }
+    double missStep = (N > m) ? 1.0 / (N - m) : 0;
+    double hitsum = 0, maxdev = 0, mindev = 0;
+    for (unsigned k = 0; k < m; k++) {
+        double hit = (NR > 0) ? weights[pos[k]] / NR : 1.0 / m;
+        double before = hitsum - (pos[k] - k) * missStep;
+        hitsum += hit;
+        mindev = min(mindev, before);
+        maxdev = max(maxdev, before + hit);
+    }
+    return (maxdev > -mindev) ? maxdev : mindev;
+}
+
+/*Reads the .gmt file (name, description, members; tab separated) and
+ *resolves every member against the gene list
+ */
+GSEA::GSEA(string gmt_file, const vector<string> &geneNames,
+        unsigned set_min, unsigned set_max)
+{
+    this->set_min = set_min;
+    this->set_max = set_max;
+    nperm = 0;
+    seed = 9141976; // same seed the java command line used
+    threads = 1;
+    numGenes = geneNames.size();
+
+    map<string, unsigned> geneIndex;
+    for (unsigned i = 0; i < numGenes; i++) {
+        geneIndex.insert(make_pair(toUpper(geneNames[i]), i));
+    }
+
+    ifstream gmt;
+    gmt.open(gmt_file);
+    if (!gmt.is_open()) {
+        cerr << "Could not open gene set database " << gmt_file << endl;
+        exit(1);
+    }
+    string line;
+    while (getline(gmt, line)) {
+        istringstream lineStream(line);
+        string name, description, gene;
+        if (!getline(lineStream, name, '\t') || name.empty()) {
+            continue;
+        }
+        getline(lineStream, description, '\t');
+        vector<unsigned> set;
+        while (getline(lineStream, gene, '\t')) {
+            auto it = geneIndex.find(gene);
+            if (it != geneIndex.end()) {
+                set.push_back(it->second);
+            }
+        }
+        sort(set.begin(), set.end());
+        set.erase(unique(set.begin(), set.end()), set.end());
+        names.push_back(name);
+        members.push_back(set);
+    }
+
+    setsOfGene.resize(numGenes);
+    for (unsigned s = 0; s < members.size(); s++) {
+        for (unsigned i = 0; i < members[s].size(); i++) {
+            setsOfGene[members[s][i]].push_back(s);
+        }
+    }
+}
+
+/*nperm = 0 computes enrichment scores only */
+void GSEA::setPermutations(unsigned nperm, unsigned seed, unsigned threads)
+{
+    this->nperm = nperm;
+    this->seed = seed;
+    this->threads = threads ? threads : 1;
+}
+
+unsigned GSEA::numGeneSets()
+{
+    return names.size();
+}
+
+const string &GSEA::getName(unsigned id) const
+{
+    return names[id];
+}
+
+/*Scores one ranked list (one score per gene, in gene list order; NaN scores
+ *are left out of the list as GSEA input files omit them)
+ *Without permute (or with nperm = 0) only the observed enrichment scores are
+ *computed, which is all CSAX needs to rank gene sets
+ */
+vector<GSEAResult> GSEA::run(const vector<double> &scores, bool permute)
+{
+    if (scores.size() != numGenes) {
+        cerr << "GSEA given " << scores.size() << " scores for "
+             << numGenes << " genes!" << endl;
+        exit(1);
+    }
+
+    vector<unsigned> order;
+    for (unsigned i = 0; i < numGenes; i++) {
+        if (!std::isnan(scores[i])) {
+            order.push_back(i);
+        }
+    }
+    stable_sort(order.begin(), order.end(), [&scores](unsigned a, unsigned b)
+            { return scores[a] > scores[b]; });
+    unsigned N = order.size();
+
+    // Members present in the list and their total weight
+    unsigned numSets = names.size();
+    vector<GSEAResult> results(numSets);
+    vector<double> NR(numSets, 0);
+    for (unsigned s = 0; s < numSets; s++) {
+        results[s].size = 0;
+        for (unsigned i = 0; i < members[s].size(); i++) {
+            double score = scores[members[s][i]];
+            if (!std::isnan(score)) {
+                results[s].size++;
+                NR[s] += fabs(score);
+            }
+        }
+    }
+
+    // One pass down the ranked list updates the running sum of every set
+    // the gene belongs to, so all sets cost O(genes + members)
+    vector<unsigned> hits(numSets, 0);
+    vector<double> hitsum(numSets, 0), maxdev(numSets, 0), mindev(numSets, 0);
+    for (unsigned j = 0; j < N; j++) {
+        unsigned g = order[j];
+        const vector<unsigned> &sets = setsOfGene[g];
+        for (unsigned k = 0; k < sets.size(); k++) {
+            unsigned s = sets[k];
+            unsigned m = results[s].size;
+            double missStep = (N > m) ? 1.0 / (N - m) : 0;
+            double hit = (NR[s] > 0) ? fabs(scores[g]) / NR[s] : 1.0 / m;
+            double before = hitsum[s] - (j - hits[s]) * missStep;
+            hitsum[s] += hit;
+            hits[s]++;
+            mindev[s] = min(mindev[s], before);
+            maxdev[s] = max(maxdev[s], before + hit);
+        }
+    }
+
+    vector<unsigned> sizes(numSets, 0);
+    for (unsigned s = 0; s < numSets; s++) {
+        results[s].ES = (maxdev[s] > -mindev[s]) ? maxdev[s] : mindev[s];
+        results[s].NES = 0;
+        results[s].pval = 1;
+        if (results[s].size >= set_min && results[s].size <= set_max) {
+            sizes[s] = results[s].size;
+        }
+    }
+
+    if (!permute || nperm == 0) {
+        return results;
+    }
+
+    vector<double> weights(N);
+    for (unsigned j = 0; j < N; j++) {
+        weights[j] = fabs(scores[order[j]]);
+    }
+    vector<vector<double> > null;
+    nullDistribution(weights, sizes, null);
+
+    for (unsigned s = 0; s < numSets; s++) {
+        if (sizes[s] == 0) {
+            continue;
+        }
+        double ES = results[s].ES;
+        double sum = 0;
+        unsigned sameSign = 0, asExtreme = 0;
+        for (unsigned p = 0; p < nperm; p++) {
+            double e = null[s][p];
+            if ((ES >= 0) == (e >= 0)) {
+                sum += e;
+                sameSign++;
+                if (fabs(e) >= fabs(ES)) {
+                    asExtreme++;
+                }
+            }
+        }
+        if (sameSign > 0) {
+            results[s].NES = ES / fabs(sum / sameSign);
+            results[s].pval = (double)asExtreme / sameSign;
+        }
+    }
+
+    return results;
+}
+
+/*Gene set permutation: for each permutation and each set of size m (sizes[s]
+ *is 0 for sets outside [set_min, set_max]), the enrichment score of m random
+ *ranks. Permutations are spread over threads; each one has its own seeded
+ *generator so results do not depend on the number of threads.
+ */
+void GSEA::nullDistribution(const vector<double> &weights,
+        const vector<unsigned> &sizes, vector<vector<double> > &null)
+{
+    unsigned N = weights.size();
+    unsigned numSets = sizes.size();
+    null.assign(numSets, vector<double>(nperm, 0));
+
+    auto worker = [&](unsigned first) {
+        vector<unsigned> ranks(N);
+        for (unsigned j = 0; j < N; j++) {
+            ranks[j] = j;
+        }
+        vector<unsigned> pos;
+        for (unsigned p = first; p < nperm; p += threads) {
+            mt19937 rng(seed + p);
+            for (unsigned s = 0; s < numSets; s++) {
+                unsigned m = sizes[s];
+                if (m == 0) {
+                    continue;
+                }
+                // partial Fisher-Yates; ranks stays a permutation of 0..N-1
+                for (unsigned k = 0; k < m; k++) {
+                    uniform_int_distribution<unsigned> pick(k, N - 1);
+                    swap(ranks[k], ranks[pick(rng)]);
+                }
+                pos.assign(ranks.begin(), ranks.begin() + m);
+                sort(pos.begin(), pos.end());
+                null[s][p] = runningSumES(pos.data(), m, weights.data(), N);
+            }
+        }
+    };
+
+    vector<thread> pool;
+    for (unsigned t = 1; t < threads && t < nperm; t++) {
+        pool.push_back(thread(worker, t));
+    }
+    worker(0);
+    for (unsigned t = 0; t < pool.size(); t++) {
+        pool[t].join();
+    }
+}
+
+/*Enrichment scores of the gene sets with positive enrichment (what GSEA's
+ *gsea_report_for_na_pos file lists), indexed by gene set id; NaN for the
+ *other sets
+ *ES only: no permutations, NES or p-values
+ */
+vector<double> GSEA::enrichmentScores(const vector<double> &scores)
+{
+    vector<GSEAResult> results = run(scores);
+    vector<double> ES(results.size(), NAN);
+    for (unsigned s = 0; s < results.size(); s++) {
+        if (results[s].size >= set_min && results[s].size <= set_max &&
+                results[s].ES > 0) {
+            ES[s] = results[s].ES;
+        }
+    }
+    return ES;
+}
+
+/*Writes the gene sets with positive enrichment, sorted by NES as in GSEA's
+ *report, with permutation statistics if permutations are turned on
+ */
+void GSEA::writeReport(const vector<double> &scores, string filename)
+{
+    vector<GSEAResult> results = run(scores, true);
+    vector<unsigned> order;
+    for (unsigned s = 0; s < results.size(); s++) {
+        if (results[s].size >= set_min && results[s].size <= set_max &&
+                results[s].ES > 0) {
+            order.push_back(s);
+        }
+    }
+    stable_sort(order.begin(), order.end(), [&results](unsigned a, unsigned b)
+            { return results[a].NES != results[b].NES ?
+                results[a].NES > results[b].NES : results[a].ES > results[b].ES; });
+
+    ofstream f;
+    f.open(filename);
+    f << "NAME\tSIZE\tES\tNES\tNOM p-val" << endl;
+    for (unsigned i = 0; i < order.size(); i++) {
+        unsigned s = order[i];
+        f << names[s] << "\t" << results[s].size << "\t" << results[s].ES
+          << "\t" << results[s].NES << "\t" << results[s].pval << endl;
+    }
+    f.close();
+}
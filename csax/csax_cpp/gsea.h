@@ -0,0 +1,49 @@
+// Native preranked GSEA Interface
+// Replaces the per-sample "java xtools.gsea.GseaPreranked" call
+
+#ifndef GSEA_H
+#define GSEA_H
+
+#include <string>
+#include <vector>
+using namespace std;
+
+/*results for one gene set, as in the columns of GSEA's report */
+struct GSEAResult {
+    double ES;     // enrichment score
+    double NES;    // normalized enrichment score (0 without permutations)
+    double pval;   // nominal p-value (1 without permutations)
+    unsigned size; // number of members present in the ranked list
+};
+
+/*weighted (p = 1) Kolmogorov-Smirnov enrichment scores for a preranked list
+ *of genes. The .gmt file is read once, its members are resolved against the
+ *gene list, and then any number of score vectors (one score per gene, same
+ *order as the gene list) can be scored without touching disk.
+ */
+class GSEA {
+    public:
+        GSEA(string gmt_file, const vector<string> &geneNames,
+                unsigned set_min = 7, unsigned set_max = 500);
+        void setPermutations(unsigned nperm, unsigned seed, unsigned threads);
+        vector<GSEAResult> run(const vector<double> &scores,
+                bool permute = false);
+        vector<double> enrichmentScores(const vector<double> &scores);
+        void writeReport(const vector<double> &scores, string filename);
+        unsigned numGeneSets();
+        const string &getName(unsigned id) const;
+    private:
+        void nullDistribution(const vector<double> &weights,
+                const vector<unsigned> &sizes, vector<vector<double> > &null);
+        vector<string> names;
+        vector<vector<unsigned> > members;    // gene indices of each set
+        vector<vector<unsigned> > setsOfGene; // set ids of each gene
+        unsigned numGenes;
+        unsigned set_min;
+        unsigned set_max;
+        unsigned nperm;
+        unsigned seed;
+        unsigned threads;
+};
+
+#endif
@@ -4,6 +4,8 @@
 
 #include "sample.h"
 #include "csaxfuncs.h"
+#include "matrixfile.h"
+#include "profile.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <fstream>
@@ -24,79 +26,283 @@ echo -ne "\nRESULT: CSAX AUC=`auc.r examples.input/example.test.set.labels examp
  //   vector<Sample *> data;
   //  vector<string> geneNames;
 //};
-SampleList getData(string matrixFile);
-void printSamples(vector<Sample> samples);
+SampleMatrix getData(string matrixFile);
+SampleMatrix readTextMatrix(string matrixFile);
+void convertMatrix(string textFile, string binaryFile, unsigned valueSize);
+
+void usage(ostream &out)
+{
+    out << "Usage: ./csax [options] <training set> <test set> "
+        << "<gene set database> <output directory>" << endl
+        << "  -B <integer>  number of bagging iterations (default 40)" << endl
+        << "  -Y <real>     gamma, the discount parameter (default 0.95)" << endl
+        << "  -P <integer>  GSEA permutations for gsea_report.<sample> files"
+        << " (default 0:" << endl
+        << "                enrichment scores only, no reports)" << endl
+        << "  -j <integer>  number of bags to run at once (default 1)" << endl
+        << "  -I <integer>  also write the scores after every <integer> bags"
+        << endl
+        << "                (csax_anomaly_scores.<bags>, default 0: never)"
+        << endl
+        << "  -S <integer>  seed of the bags (default 1)" << endl
+        << "  -K <dir>      cache FRaC results in <dir> and reuse them"
+        << endl
+        << "  --resume      continue the run checkpointed in the output"
+        << " directory" << endl
+        << "  -M <dir>      save the trained feature models of each bag in <dir>,"
+        << endl
+        << "                or load them if they are there" << endl
+        << "  --score       only score with the models in -M, never train"
+        << endl
+        << "  --worker      run the whole training set and bags not yet claimed"
+        << " by" << endl
+        << "                another worker in <output directory>/queue (which"
+        << " can be on" << endl
+        << "                a shared filesystem)" << endl
+        << "  --reclaim     with --worker, also run items whose worker on this"
+        << " host died" << endl
+        << "  --reduce      write the scores of the bags the workers finished"
+        << endl
+        << "  --profile <file>  write the time, CPU time and peak memory of each"
+        << " stage" << endl
+        << "                as JSON to <file>" << endl
+        << "  --trace <file>    also write every timed stage as a Chrome trace"
+        << " to <file>" << endl
+        << "       ./csax --serve -M <dir> [-B, -S, -Y as trained] [-U <socket>]"
+        << " [-T <integer>]" << endl
+        << "              <training set> <gene set database>" << endl
+        << "  --serve       keep the models in -M loaded and score samples sent"
+        << " one per line" << endl
+        << "                (name, then one value per gene) on stdin or <socket>"
+        << endl
+        << "  -U <socket>   Unix domain socket to serve on (default stdin)"
+        << endl
+        << "  -T <integer>  gene sets reported per sample (default 5)" << endl
+        << "       ./csax -C <binary matrix> [-F 32|64] <text matrix>" << endl
+        << "  -C <file>     convert a text matrix to the binary matrix format"
+        << endl
+        << "                (either format can be given as a training or test"
+        << " set)" << endl
+        << "  -F <integer>  bits per value of the binary matrix (default 64)"
+        << endl;
+}
 
 int main(int argc, char **argv) {
-    if (argc < 5) {
-        //cerr << "Usage: ./csax [options] <training set> <test set> "
-        //     << "<gene set database> <output directory>"
-        //     << endl;
-         cerr << "Usage: ./csax -B <number of iterations> <training set> <test set> "
-             << "<gene set database> <output directory>" << endl;
+    CSAXOptions options;
+    options.num_bags = 40; // Default number of bags
+    options.gamma = .95; // Default gamma value
+    options.nperm = 0; // Ranking only needs enrichment scores
+    options.jobs = 1;
+    options.interim = 0;
+    options.seed = 1;
+    options.cache_dir = "";
+    options.resume = false;
+    options.model_dir = "";
+    options.score_only = false;
+    options.socket_path = "";
+    options.top_sets = 5;
+    options.worker = false;
+    options.reduce = false;
+    options.reclaim = false;
+    bool serve = false;
+    string convertTo = "";
+    unsigned valueBits = 64;
+    string profileFile = "";
+    string traceFile = "";
+
+    // options come first, then the four file arguments
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        string option = argv[i];
+        if (option == "-h") {
+            usage(cout);
+            exit(0);
+        }
+        if (option == "--resume") {
+            options.resume = true;
+            continue;
+        }
+        if (option == "--score") {
+            options.score_only = true;
+            continue;
+        }
+        if (option == "--worker") {
+            options.worker = true;
+            continue;
+        }
+        if (option == "--reclaim") {
+            options.reclaim = true;
+            continue;
+        }
+        if (option == "--reduce") {
+            options.reduce = true;
+            continue;
+        }
+        if (option == "--serve") {
+            serve = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(cerr);
+            exit(1);
+        }
+        if (option == "-B") {
+            options.num_bags = atoi(argv[++i]);
+        } else if (option == "-Y") {
+            options.gamma = atof(argv[++i]);
+        } else if (option == "-P") {
+            options.nperm = atoi(argv[++i]);
+        } else if (option == "-j") {
+            options.jobs = atoi(argv[++i]);
+        } else if (option == "-I") {
+            options.interim = atoi(argv[++i]);
+        } else if (option == "-S") {
+            options.seed = strtoul(argv[++i], NULL, 10);
+        } else if (option == "-K") {
+            options.cache_dir = argv[++i];
+        } else if (option == "-M") {
+            options.model_dir = argv[++i];
+        } else if (option == "-U") {
+            options.socket_path = argv[++i];
+        } else if (option == "-T") {
+            options.top_sets = atoi(argv[++i]);
+        } else if (option == "--profile") {
+            profileFile = argv[++i];
+        } else if (option == "--trace") {
+            traceFile = argv[++i];
+        } else if (option == "-C") {
+            convertTo = argv[++i];
+        } else if (option == "-F") {
+            valueBits = atoi(argv[++i]);
+            if (valueBits != 32 && valueBits != 64) {
+                cerr << "-F must be 32 or 64" << endl;
+                exit(1);
+            }
+        } else {
+            cerr << "Unknown option: " << option << endl;
+            usage(cerr);
+            exit(1);
+        }
+    }
+    if (profileFile != "" || traceFile != "") {
+        enableProfile(traceFile != "");
+    }
+    if (convertTo != "") {
+        if (argc - i != 1) {
+            usage(cerr);
+            exit(1);
+        }
+        convertMatrix(argv[i], convertTo, valueBits / 8);
+        exit(0);
+    }
+    if (serve) {
+        if (argc - i != 2) {
+            usage(cerr);
+            exit(1);
+        }
+        SampleMatrix traindata = getData(argv[i]);
+        serveCSAX(traindata, (string)argv[i + 1], options);
+        exit(0);
+    }
+    if (argc - i != 4) {
+        usage(cerr);
         exit(1);
     }
-
-    string help = "-h";
-    if (argv[1] == help.c_str()) {
-         cout << "Usage: ./csax -B <number of iterations> <training set> <test set> "
-              << "<gene set database> <output directory>" << endl;
-         exit(0);
+    if (options.worker && options.reduce) {
+        cerr << "--worker and --reduce are separate runs" << endl;
+        exit(1);
+    }
+    if (options.reclaim && !options.worker) {
+        cerr << "--reclaim is an option of --worker" << endl;
+        exit(1);
     }
 
-    int num_bags = atoi(argv[2]); // Default number of bags
-    double gamma = .95; // Default gamma value
-
-    SampleList traindata = getData(argv[3]);
-    SampleList testdata = getData(argv[4]);
-    runCSAX(traindata, testdata, (string)argv[4], (string)argv[5], (string)argv[6], num_bags, gamma);
+    SampleMatrix traindata = getData(argv[i]);
+    SampleMatrix testdata = getData(argv[i + 1]);
+    runCSAX(traindata, testdata, (string)argv[i + 2], (string)argv[i + 3],
+            options);
+    if (profileFile != "") {
+        writeProfile(profileFile);
+    }
+    if (traceFile != "") {
+        writeTrace(traceFile);
+    }
 
 }
-/* Parses the csax input file
+/* Loads a csax input file, either a binary matrix file (mapped; float64
+ * values are used in place, for the rest of the run) or a text matrix
+ */
+SampleMatrix getData(string matrixFile)
+{
+    ProfileScope scope("parse_input");
+    if (isMatrixFile(matrixFile)) {
+        return SampleMatrix(mapMatrixFile(matrixFile));
+    }
+    return readTextMatrix(matrixFile);
+}
+
+/* Parses a csax text input file (a header line of sample names, then one
+ * line per gene: its name and one value per sample)
+ * A first pass reads the gene names, so the sample-major matrix can be
+ * allocated; a second pass reads each gene's line into one row buffer and
+ * scatters it into the matrix
  */
-SampleList getData(string matrixFile)
+SampleMatrix readTextMatrix(string matrixFile)
 {
-    vector<Sample*> inputBuffer;
     ifstream matrix;
     matrix.open(matrixFile);
     string line = "";
     string name;
     vector<string> nameSamples;
     vector<string> nameGenes;
-    unsigned numNames = 0;
-    double tempdouble = 0.0;
-    vector<vector<double>> buffer;
-    if (matrix.is_open()) {
-        getline(matrix, line);
-        istringstream lineStream (line);
-        while (lineStream >> name) {
-            nameSamples.push_back(name);
-            numNames++;
-        }
-        while (matrix >> name) {
+    if (!matrix.is_open()) {
+        cerr << "Could not open " << matrixFile << endl;
+        exit(1);
+    }
+    getline(matrix, line);
+    istringstream lineStream (line);
+    while (lineStream >> name) {
+        nameSamples.push_back(name);
+    }
+    unsigned numNames = nameSamples.size();
+    streampos dataStart = matrix.tellg();
+    while (getline(matrix, line)) {
+        istringstream fields(line);
+        if (fields >> name) {
             nameGenes.push_back(name);
-            vector<double> oneRow;
+        }
+    }
 
-            for (unsigned i = 0; i < numNames; i++) {
-                matrix >> tempdouble;
-                oneRow.push_back(tempdouble);
-            }
-            buffer.push_back(oneRow);
+    unsigned numGenes = nameGenes.size();
+    SampleMatrix samples(nameSamples, nameGenes);
+    double *values = samples.mutableData();
+    vector<double> row(numNames);
+    matrix.clear();
+    matrix.seekg(dataStart);
+    for (unsigned g = 0; g < numGenes && getline(matrix, line); ) {
+        istringstream fields(line);
+        if (!(fields >> name)) {
+            continue;
         }
-        unsigned numGenes = nameGenes.size();
-        //using buffer, extract one sample at a time, put it into the return
-        //vector
         for (unsigned j = 0; j < numNames; j++) {
-            vector<double> onesample;
-            for (unsigned i = 0; i < buffer.size(); i++) {
-                onesample.push_back(buffer[i][j]);
-            }
-            Sample *newSample = new Sample(numGenes, (string)nameSamples[j], onesample);
-            inputBuffer.push_back(newSample);
+            fields >> row[j];
+        }
+        for (unsigned j = 0; j < numNames; j++) {
+            values[(size_t)j * numGenes + g] = row[j];
         }
+        g++;
     }
-
-    return {inputBuffer, nameGenes};
+    return samples;
 }
 
-
+/* Converts a csax text input file to the binary matrix format
+ * (valueSize 4 for float32, 8 for float64)
+ */
+void convertMatrix(string textFile, string binaryFile, unsigned valueSize)
+{
+    SampleMatrix samples = readTextMatrix(textFile);
+    writeMatrixFile(binaryFile, samples.getSampleNames(),
+            samples.getGeneNames(), samples.data(), valueSize);
+    cout << "Wrote " << samples.numSamples() << " samples x "
+         << samples.numGenes() << " genes to " << binaryFile << endl;
+}
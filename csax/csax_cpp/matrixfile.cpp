@@ -0,0 +1,147 @@
+// Binary expression matrix file Implementation
+// See matrixfile.h for the layout
+
+#include "matrixfile.h"
+#include <fstream>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+static const char MAGIC[8] = {'C', 'S', 'A', 'X', 'M', 'A', 'T', '1'};
+
+/*true if filename starts with the binary matrix magic */
+bool isMatrixFile(string filename)
+{
+    ifstream f(filename, ios::binary);
+    char magic[8];
+    return f.read(magic, 8) && memcmp(magic, MAGIC, 8) == 0;
+}
+
+/*Maps a binary matrix file read-only. Only the name tables are copied out;
+ *exits on a file that is not a valid matrix file
+ */
+MatrixFile *mapMatrixFile(string filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        cerr << "Could not open matrix file " << filename << endl;
+        exit(1);
+    }
+    size_t length = st.st_size;
+    void *mapping = (length > 0) ?
+        mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        cerr << "Could not map matrix file " << filename << endl;
+        exit(1);
+    }
+
+    const char *base = (const char *)mapping;
+    MatrixFileHeader header;
+    bool valid = length >= sizeof(header);
+    if (valid) {
+        memcpy(&header, base, sizeof(header));
+        uint64_t count = header.numSamples * header.numGenes;
+        valid = memcmp(header.magic, MAGIC, 8) == 0 &&
+            (header.valueSize == 4 || header.valueSize == 8) &&
+            header.namesOffset <= header.dataOffset &&
+            header.dataOffset % 8 == 0 && header.dataOffset <= length &&
+            (header.numGenes == 0 ||
+             count / header.numGenes == header.numSamples) &&
+            count <= (length - header.dataOffset) / header.valueSize;
+    }
+    if (!valid) {
+        cerr << filename << " is not a valid CSAX matrix file" << endl;
+        exit(1);
+    }
+
+    MatrixFile *file = new MatrixFile;
+    file->valueSize = header.valueSize;
+    file->data = base + header.dataOffset;
+    file->mapping = mapping;
+    file->length = length;
+
+    const char *name = base + header.namesOffset;
+    const char *end = base + header.dataOffset;
+    uint64_t numNames = header.numSamples + header.numGenes;
+    for (uint64_t i = 0; i < numNames; i++) {
+        const char *stop = (const char *)memchr(name, '\0', end - name);
+        if (stop == NULL) {
+            cerr << filename << ": truncated name table" << endl;
+            exit(1);
+        }
+        if (i < header.numSamples) {
+            file->sampleNames.push_back(string(name, stop));
+        } else {
+            file->geneNames.push_back(string(name, stop));
+        }
+        name = stop + 1;
+    }
+
+    return file;
+}
+
+void unmapMatrixFile(MatrixFile *file)
+{
+    munmap(file->mapping, file->length);
+    delete file;
+}
+
+/*Writes a sample-major block of numSamples x numGenes values as a binary
+ *matrix file of float32 (valueSize 4) or float64 (valueSize 8) values
+ */
+void writeMatrixFile(string filename, const vector<string> &sampleNames,
+        const vector<string> &geneNames, const double *values,
+        unsigned valueSize)
+{
+    ofstream f(filename, ios::binary | ios::trunc);
+    if (!f.is_open()) {
+        cerr << "Could not write matrix file " << filename << endl;
+        exit(1);
+    }
+
+    string names;
+    for (unsigned i = 0; i < sampleNames.size(); i++) {
+        names += sampleNames[i];
+        names += '\0';
+    }
+    for (unsigned i = 0; i < geneNames.size(); i++) {
+        names += geneNames[i];
+        names += '\0';
+    }
+    while ((sizeof(MatrixFileHeader) + names.size()) % 8 != 0) {
+        names += '\0';
+    }
+
+    MatrixFileHeader header;
+    memcpy(header.magic, MAGIC, 8);
+    header.valueSize = valueSize;
+    header.reserved = 0;
+    header.numSamples = sampleNames.size();
+    header.numGenes = geneNames.size();
+    header.namesOffset = sizeof(header);
+    header.dataOffset = sizeof(header) + names.size();
+    f.write((const char *)&header, sizeof(header));
+    f.write(names.data(), names.size());
+
+    size_t numGenes = geneNames.size();
+    for (unsigned i = 0; i < sampleNames.size(); i++) {
+        const double *sample = values + i * numGenes;
+        if (valueSize == 4) {
+            vector<float> floats(sample, sample + numGenes);
+            f.write((const char *)floats.data(), numGenes * 4);
+        } else {
+            f.write((const char *)sample, numGenes * 8);
+        }
+    }
+    if (!f.good()) {
+        cerr << "Error writing matrix file " << filename << endl;
+        exit(1);
+    }
+}
@@ -0,0 +1,52 @@
+// Binary expression matrix file Interface
+// A memory-mapped alternative to the genes x samples text matrices
+
+#ifndef MATRIXFILE_H
+#define MATRIXFILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+/*File layout (native byte order, all offsets from the start of the file):
+ *    char     magic[8]      "CSAXMAT1"
+ *    uint32_t valueSize     4 (float32) or 8 (float64)
+ *    uint32_t reserved      0
+ *    uint64_t numSamples
+ *    uint64_t numGenes
+ *    uint64_t namesOffset   numSamples sample names, then numGenes gene
+ *                           names, each terminated by '\0'
+ *    uint64_t dataOffset    numSamples x numGenes values, sample-major (the
+ *                           genes of one sample are contiguous); 8-aligned
+ *So a sample is one contiguous column of the text matrix and can be used in
+ *place, without parsing or transposing.
+ */
+struct MatrixFileHeader {
+    char magic[8];
+    uint32_t valueSize;
+    uint32_t reserved;
+    uint64_t numSamples;
+    uint64_t numGenes;
+    uint64_t namesOffset;
+    uint64_t dataOffset;
+};
+
+/*a mapped matrix file; values stay in the mapping */
+struct MatrixFile {
+    vector<string> sampleNames;
+    vector<string> geneNames;
+    unsigned valueSize;
+    const char *data;   // first value of the first sample
+    void *mapping;
+    size_t length;
+};
+
+bool isMatrixFile(string filename);
+MatrixFile *mapMatrixFile(string filename);
+void unmapMatrixFile(MatrixFile *file);
+void writeMatrixFile(string filename, const vector<string> &sampleNames,
+        const vector<string> &geneNames, const double *values,
+        unsigned valueSize);
+
+#endif
@@ -0,0 +1,153 @@
+// Pipeline profiling Implementation
+
+#include "profile.h"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <time.h>
+#include <sys/resource.h>
+using namespace std;
+
+/*totals of one stage */
+struct StageTotals {
+    unsigned long calls;
+    double wall;       // seconds, summed over calls (threads overlap)
+    double cpu;        // seconds of CPU of the calling threads
+    long peak_rss_kb;  // process peak RSS when a call ended
+};
+
+/*one scope, for the trace */
+struct TraceEvent {
+    const char *stage;
+    double start;
+    double duration;
+    unsigned tid;
+};
+
+static atomic<bool> PROFILE_ON(false);
+static bool TRACE_ON = false;
+static mutex PROFILE_MUTEX;
+static map<string, StageTotals> STAGES;
+static vector<TraceEvent> EVENTS;
+static const chrono::steady_clock::time_point PROFILE_EPOCH =
+    chrono::steady_clock::now();
+
+static double wallSeconds()
+{
+    return chrono::duration<double>(chrono::steady_clock::now() -
+            PROFILE_EPOCH).count();
+}
+
+static double threadCpuSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long peakRssKb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss; // kilobytes on Linux
+}
+
+/*small ids for the trace's thread rows */
+static unsigned threadNumber()
+{
+    static atomic<unsigned> next(0);
+    thread_local unsigned number = next++;
+    return number;
+}
+
+void enableProfile(bool trace)
+{
+    TRACE_ON = trace;
+    PROFILE_ON = true;
+}
+
+ProfileScope::ProfileScope(const char *stage)
+{
+    this->stage = stage;
+    if (PROFILE_ON) {
+        wall = wallSeconds();
+        cpu = threadCpuSeconds();
+    }
+}
+
+ProfileScope::~ProfileScope()
+{
+    if (!PROFILE_ON) {
+        return;
+    }
+    double end = wallSeconds();
+    double cpu_used = threadCpuSeconds() - cpu;
+    long rss = peakRssKb();
+
+    lock_guard<mutex> lock(PROFILE_MUTEX);
+    StageTotals &totals = STAGES[stage];
+    totals.calls++;
+    totals.wall += end - wall;
+    totals.cpu += cpu_used;
+    if (rss > totals.peak_rss_kb) {
+        totals.peak_rss_kb = rss;
+    }
+    if (TRACE_ON) {
+        TraceEvent event = {stage, wall, end - wall, threadNumber()};
+        EVENTS.push_back(event);
+    }
+}
+
+/*Writes the totals of every stage:
+ *{"wall_s": ..., "peak_rss_kb": ..., "stages": [{"name": ..., "calls": ...,
+ *  "wall_s": ..., "cpu_s": ..., "wall_ms_per_call": ..., "peak_rss_kb": ...}]}
+ */
+void writeProfile(string json_file)
+{
+    lock_guard<mutex> lock(PROFILE_MUTEX);
+    ofstream f(json_file);
+    if (!f.is_open()) {
+        cerr << "Could not write profile " << json_file << endl;
+        return;
+    }
+    f << "{\"wall_s\": " << wallSeconds() << ", \"peak_rss_kb\": "
+      << peakRssKb() << ", \"stages\": [";
+    bool first = true;
+    for (auto it = STAGES.begin(); it != STAGES.end(); it++) {
+        const StageTotals &t = it->second;
+        f << (first ? "" : ",") << "\n  {\"name\": \"" << it->first
+          << "\", \"calls\": " << t.calls << ", \"wall_s\": " << t.wall
+          << ", \"cpu_s\": " << t.cpu << ", \"wall_ms_per_call\": "
+          << 1000 * t.wall / t.calls << ", \"peak_rss_kb\": "
+          << t.peak_rss_kb << "}";
+        first = false;
+    }
+    f << "\n]}" << endl;
+}
+
+/*Writes the scopes as complete ("X") events of the Chrome trace event
+ *format, times in microseconds
+ */
+void writeTrace(string trace_file)
+{
+    lock_guard<mutex> lock(PROFILE_MUTEX);
+    ofstream f(trace_file);
+    if (!f.is_open()) {
+        cerr << "Could not write trace " << trace_file << endl;
+        return;
+    }
+    f << "{\"traceEvents\": [";
+    for (unsigned i = 0; i < EVENTS.size(); i++) {
+        const TraceEvent &e = EVENTS[i];
+        f << (i ? "," : "") << "\n{\"name\": \"" << e.stage
+          << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.tid
+          << ", \"ts\": " << (long long)(e.start * 1e6) << ", \"dur\": "
+          << (long long)(e.duration * 1e6) << "}";
+    }
+    f << "\n]}" << endl;
+}
@@ -0,0 +1,33 @@
+// Pipeline profiling Interface
+// Per-stage wall time, CPU time and peak RSS, written as JSON and,
+// optionally, as a Chrome trace (chrome://tracing, Perfetto)
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <string>
+using namespace std;
+
+/*Profiling is off (and ProfileScope costs one flag test) until enabled;
+ *trace also keeps every scope as a trace event
+ */
+void enableProfile(bool trace);
+
+/*Times one stage from construction to destruction, on the calling thread.
+ *Scopes may nest and run on several threads; each one is added to its
+ *stage's totals.
+ */
+class ProfileScope {
+    public:
+        ProfileScope(const char *stage);
+        ~ProfileScope();
+    private:
+        const char *stage;
+        double wall;
+        double cpu;
+};
+
+void writeProfile(string json_file);
+void writeTrace(string trace_file);
+
+#endif
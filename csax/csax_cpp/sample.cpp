@@ -1,74 +1,103 @@
 // Brett Fischler
 // April 2015
-// Sample Class Implementation
+// Sample Matrix Implementation
 
 #include "sample.h"
+#include "matrixfile.h"
 #include <iostream>
 #include <vector>
+#include <cstdlib>
 using namespace std;
 
-/*Default constructor
+/*Empty matrix
  */
-Sample::Sample(int n) {
-    genecount = n;
-
-    vector<double> newGeneset;
-    for (int i = 0; i < genecount; i++) {
-        newGeneset.push_back(0);
-    }
-    geneset = newGeneset;
-    c = -1;
+SampleMatrix::SampleMatrix() {
+    file = NULL;
+    values = NULL;
 }
 
-/*Preferred constructor, sets up all data
+/*Owned matrix of zeros, filled through mutableData()
  */
-Sample::Sample(int n, string newName, vector<double> newGenes) {
-    genecount = n;
+SampleMatrix::SampleMatrix(vector<string> newSampleNames,
+        vector<string> newGeneNames) {
+    sampleNames.swap(newSampleNames);
+    geneNames.swap(newGeneNames);
+    storage.assign((size_t)sampleNames.size() * geneNames.size(), 0);
+    file = NULL;
+    values = storage.data();
+}
 
-    vector<double> newGeneset;
-    for (int i = 0; i < genecount; i++) {
-        newGeneset.push_back(0);
+/*Matrix of a mapped matrix file, which the matrix now owns (and unmaps).
+ *float64 files are used in place; float32 files are widened into one owned
+ *block, as FRaC works on doubles
+ */
+SampleMatrix::SampleMatrix(MatrixFile *newFile) {
+    sampleNames = newFile->sampleNames;
+    geneNames = newFile->geneNames;
+    if (newFile->valueSize == 8) {
+        file = newFile;
+        values = (const double *)newFile->data;
+    } else {
+        const float *floats = (const float *)newFile->data;
+        storage.assign(floats,
+                floats + (size_t)sampleNames.size() * geneNames.size());
+        unmapMatrixFile(newFile);
+        file = NULL;
+        values = storage.data();
     }
-    geneset = newGeneset;
-    setGenes(newGenes);
-    c = -1;
-    name = newName;
 }
 
-/*self explanator accessor and mutator functions*/
-
-int Sample::getClass() {
-    return c;
+/*Moving keeps the values where they are (a moved vector keeps its block)
+ */
+SampleMatrix::SampleMatrix(SampleMatrix &&other) {
+    file = NULL;
+    values = NULL;
+    *this = move(other);
 }
 
-void Sample::setClass(int newC) {
-    c = newC;
-}
-string Sample::getName() {
-    return name;
+SampleMatrix &SampleMatrix::operator=(SampleMatrix &&other) {
+    if (this != &other) {
+        release();
+        sampleNames.swap(other.sampleNames);
+        geneNames.swap(other.geneNames);
+        storage.swap(other.storage);
+        file = other.file;
+        values = other.values;
+        other.file = NULL;
+        other.values = NULL;
+    }
+    return *this;
 }
 
-void Sample::setGene(int index, double gene) {
-    geneset[index] = gene;
+SampleMatrix::~SampleMatrix() {
+    release();
 }
 
-void Sample::setGenes(vector<double> newGenes) {
-    if ((signed)newGenes.size() != genecount) {
-        cerr << "Sample class not given vector of correct length!" << endl;
-    }
-    for (int i = 0; i < genecount; i++) {
-        geneset[i] = newGenes[i];
+void SampleMatrix::release() {
+    if (file) {
+        unmapMatrixFile(file);
     }
+    file = NULL;
+    values = NULL;
+    vector<double>().swap(storage);
 }
 
-double Sample::getGene(unsigned index) {
-    return geneset[index];
+double *SampleMatrix::mutableData() {
+    if (file) {
+        cerr << "SampleMatrix: a mapped matrix is read-only!" << endl;
+        exit(1);
+    }
+    return storage.data();
 }
 
-/*for debugging*/
-void Sample::print() {
-    for (auto i = geneset.begin(); i != geneset.end(); i++) {
-        cout << *i << endl;
-    }
+SampleView SampleMatrix::sample(unsigned i) const {
+    SampleView view = {values + (size_t)i * geneNames.size(),
+        (unsigned)geneNames.size(), &sampleNames[i]};
+    return view;
 }
 
+GeneView SampleMatrix::gene(unsigned j) const {
+    GeneView view = {values + j, (unsigned)geneNames.size(),
+        (unsigned)sampleNames.size()};
+    return view;
+}
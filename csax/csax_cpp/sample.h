@@ -1,35 +1,75 @@
 // Brett Fischler and Jacob Gerace
 // April 2015
-// Sample Class Interface
+// Sample Matrix Interface
 
 #ifndef SAMPLE_H
 #define SAMPLE_H
 
 #include <iostream>
+#include <string>
 using namespace std;
 #include<vector>
 
-/*representation of the data associated with one sample, be it a training or
- * a test sample
+struct MatrixFile;
+
+/*one sample (a row of a SampleMatrix): its name and its genecount values.
+ *Only valid as long as the matrix it came from
  */
-class Sample {
+struct SampleView {
+    const double *genes;
+    unsigned genecount;
+    const string *name;
+    double operator[](unsigned gene) const { return genes[gene]; }
+};
+
+/*one gene across the samples (a column of a SampleMatrix) */
+struct GeneView {
+    const double *first;
+    unsigned stride;
+    unsigned samplecount;
+    double operator[](unsigned sample) const {
+        return first[(size_t)sample * stride];
+    }
+};
+
+/*the data of all training or all test samples: numSamples x numGenes values
+ *in one contiguous, sample-major block (the genes of a sample are adjacent),
+ *with the sample and gene names.
+ *The block is either owned or a mapped float64 matrix file (matrixfile.h).
+ *A SampleMatrix can be moved but not copied; pass it by reference.
+ */
+class SampleMatrix {
     public:
-        /*See cpp file for comments */
-        Sample(int genecount);
-        Sample(int genecount, string newName, vector<double> newGenes);
-        int getClass();
-        void setClass(int c);
-        void setGene(int index, double gene);
-        string getName();
-        void setGenes(vector<double> newGenes);
-        void print();
-        double getGene(unsigned index);
+        SampleMatrix();
+        SampleMatrix(vector<string> sampleNames, vector<string> geneNames);
+        SampleMatrix(MatrixFile *file);
+        SampleMatrix(SampleMatrix &&other);
+        SampleMatrix &operator=(SampleMatrix &&other);
+        SampleMatrix(const SampleMatrix &) = delete;
+        SampleMatrix &operator=(const SampleMatrix &) = delete;
+        ~SampleMatrix();
+
+        unsigned numSamples() const { return sampleNames.size(); }
+        unsigned numGenes() const { return geneNames.size(); }
+        const vector<string> &getSampleNames() const { return sampleNames; }
+        const vector<string> &getGeneNames() const { return geneNames; }
+        const string &getName(unsigned sample) const {
+            return sampleNames[sample];
+        }
+        const double *data() const { return values; }
+        double *mutableData(); // only for owned matrices
+        SampleView sample(unsigned i) const;
+        GeneView gene(unsigned j) const;
+        double get(unsigned sample, unsigned gene) const {
+            return values[(size_t)sample * geneNames.size() + gene];
+        }
     private:
-        /*reprsented by a vector of doubles and a name */
-        vector<double> geneset;
-        string name;
-        int genecount;
-        int c;
+        void release();
+        vector<string> sampleNames;
+        vector<string> geneNames;
+        vector<double> storage; // owned values, if not mapped
+        MatrixFile *file;       // mapping the values are in, if mapped
+        const double *values;
 };
 
 #endif
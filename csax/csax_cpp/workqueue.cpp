@@ -0,0 +1,207 @@
+// CSAX work queue Implementation
+// See workqueue.h for the layout
+
+#include "workqueue.h"
+#include "checkpoint.h"
+#include "cache.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+using namespace std;
+
+const unsigned WorkQueue::FULL_SET;
+
+static string hostName()
+{
+    char host[256];
+    if (gethostname(host, sizeof(host)) != 0) {
+        host[0] = '\0';
+    }
+    host[sizeof(host) - 1] = '\0';
+    return host;
+}
+
+/*"<host> <pid>", which names a worker on a shared filesystem */
+static string workerName()
+{
+    return hostName() + " " + to_string(getpid());
+}
+
+/*files being written get a name no other worker uses */
+static string tempSuffix()
+{
+    return ".tmp." + hostName() + "." + to_string(getpid());
+}
+
+/*Joins the queue in dir, which is created if needed. The first to join
+ *records the run's fingerprint; joining a queue of another run exits
+ */
+WorkQueue::WorkQueue(string dir, uint64_t fingerprint, unsigned numTests,
+        unsigned numSets)
+{
+    this->dir = makeDirectory(dir);
+    this->fingerprint = fingerprint;
+    this->numTests = numTests;
+    this->numSets = numSets;
+
+    // link() is atomic (also over NFS), so the run file is either missing
+    // or complete
+    string run = this->dir + "run";
+    string temp = run + tempSuffix();
+    ofstream out(temp);
+    out << hex << fingerprint << endl;
+    out.close();
+    if (!out || (link(temp.c_str(), run.c_str()) != 0 && errno != EEXIST)) {
+        cerr << "Could not write " << run << endl;
+        remove(temp.c_str());
+        exit(1);
+    }
+    remove(temp.c_str());
+
+    ifstream in(run);
+    uint64_t stored = 0;
+    in >> hex >> stored;
+    if (!in || stored != fingerprint) {
+        cerr << this->dir << " is the work queue of a run with other inputs"
+             << " or settings; use another output directory or remove it"
+             << endl;
+        exit(1);
+    }
+}
+
+string WorkQueue::path(unsigned item)
+{
+    return dir + (item == FULL_SET ? string("full") :
+            "bag." + to_string(item));
+}
+
+string WorkQueue::tempPath(unsigned item)
+{
+    return path(item) + tempSuffix();
+}
+
+/*Claims item for this process; false if a worker already has */
+bool WorkQueue::claim(unsigned item)
+{
+    string lock = path(item) + ".lock";
+    int fd = open(lock.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        if (errno == EEXIST) {
+            return false;
+        }
+        cerr << "Could not create " << lock << endl;
+        exit(1);
+    }
+    string name = workerName() + "\n";
+    if (write(fd, name.data(), name.size()) != (ssize_t)name.size()) {
+        cerr << "Warning: could not write the owner of " << lock << endl;
+    }
+    close(fd);
+    return true;
+}
+
+/*Claims item for this process if the worker that claimed it ran on this
+ *host and is gone (no process has its pid) before finishing it; false
+ *otherwise. The lock is replaced by rename(), so two workers reclaiming the
+ *same item at once can at worst both run it, and publish the same result
+ */
+bool WorkQueue::reclaim(unsigned item)
+{
+    istringstream owned(owner(item));
+    string host;
+    long pid = 0;
+    if (!(owned >> host >> pid) || host != hostName() || pid <= 0) {
+        return false;
+    }
+    if (kill((pid_t)pid, 0) == 0 || errno != ESRCH) {
+        return false;
+    }
+    if (access(path(item).c_str(), F_OK) == 0) {
+        return false;
+    }
+
+    string lock = path(item) + ".lock";
+    string temp = lock + tempSuffix();
+    ofstream out(temp);
+    out << workerName() << endl;
+    out.close();
+    if (!out || rename(temp.c_str(), lock.c_str()) != 0) {
+        cerr << "Could not write " << lock << endl;
+        remove(temp.c_str());
+        exit(1);
+    }
+    if (owner(item) != workerName()) {
+        return false;
+    }
+    cerr << "Reclaimed " << lock << " of " << host << " " << pid << endl;
+    return true;
+}
+
+/*The worker that claimed item, "" if none has */
+string WorkQueue::owner(unsigned item)
+{
+    ifstream in(path(item) + ".lock");
+    string name;
+    getline(in, name);
+    return name;
+}
+
+void WorkQueue::publish(unsigned item, string temp)
+{
+    if (rename(temp.c_str(), path(item).c_str()) != 0) {
+        cerr << "Could not write " << path(item) << endl;
+        remove(temp.c_str());
+        exit(1);
+    }
+}
+
+void WorkQueue::finishFullSet(const vector<vector<double> > &ES)
+{
+    string temp = tempPath(FULL_SET);
+    {
+        Checkpoint result(temp, fingerprint, numTests, numSets,
+                Checkpoint::CREATE);
+        result.writeFullSet(ES);
+    }
+    publish(FULL_SET, temp);
+}
+
+void WorkQueue::finishBag(unsigned b,
+        const vector<vector<unsigned> > &rankings)
+{
+    string temp = tempPath(b);
+    {
+        Checkpoint result(temp, fingerprint, numTests, numSets,
+                Checkpoint::CREATE);
+        result.writeBag(b, rankings);
+    }
+    publish(b, temp);
+}
+
+/*The enrichment scores of the full training set, if a worker finished it */
+bool WorkQueue::fullSet(vector<vector<double> > &ES)
+{
+    if (access(path(FULL_SET).c_str(), F_OK) != 0) {
+        return false;
+    }
+    Checkpoint result(path(FULL_SET), fingerprint, numTests, numSets,
+            Checkpoint::READ);
+    return result.fullSet(ES);
+}
+
+/*The rankings of bag b, if a worker finished it */
+bool WorkQueue::bag(unsigned b, vector<vector<unsigned> > &rankings)
+{
+    if (access(path(b).c_str(), F_OK) != 0) {
+        return false;
+    }
+    Checkpoint result(path(b), fingerprint, numTests, numSets,
+            Checkpoint::READ);
+    return result.bag(b, rankings);
+}
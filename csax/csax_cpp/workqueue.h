@@ -0,0 +1,47 @@
+// CSAX work queue Interface
+// The full training set and bags of one run, shared by worker processes
+// through a directory (which can be on a shared filesystem)
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+/*Directory layout:
+ *    run            the fingerprint of the run, written by the first worker;
+ *                   workers and the reduce step of other runs are refused
+ *    <item>.lock    created (O_EXCL) by the worker that claims the item, and
+ *                   holds "<host> <pid>"; never removed, so every item runs
+ *                   once. --reclaim takes over the lock of a worker of this
+ *                   host that is gone; for other hosts delete it by hand.
+ *    <item>         the result, a checkpoint file (see checkpoint.h) with
+ *                   the one record, renamed into place once complete
+ *where <item> is "full" for the full training set and "bag.<b>" for bag b.
+ */
+class WorkQueue {
+    public:
+        static const unsigned FULL_SET = 0xffffffff;
+
+        WorkQueue(string dir, uint64_t fingerprint, unsigned numTests,
+                unsigned numSets);
+        bool claim(unsigned item);
+        bool reclaim(unsigned item);
+        string owner(unsigned item);
+        void finishFullSet(const vector<vector<double> > &ES);
+        void finishBag(unsigned b, const vector<vector<unsigned> > &rankings);
+        bool fullSet(vector<vector<double> > &ES);
+        bool bag(unsigned b, vector<vector<unsigned> > &rankings);
+    private:
+        string path(unsigned item);
+        string tempPath(unsigned item);
+        void publish(unsigned item, string temp);
+        string dir;
+        uint64_t fingerprint;
+        unsigned numTests;
+        unsigned numSets;
+};
+
+#endif